@@ -0,0 +1,355 @@
+#include "ApproximateDistance.h"
+#include "AverageDistance.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+ApproximateDistance::AverageEstimate ApproximateDistance::average(const PointCloud &cloud, double tolerance, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    AverageEstimate estimate;
+    if (n < 2)
+    {
+        return estimate;
+    }
+    if (n <= kExactLimit || !(tolerance > 0))
+    {
+        AverageDistance::Result result = AverageDistance::compute(cloud, pool);
+        estimate.average = result.average();
+        estimate.samples = result.pairCount;
+        estimate.exact = true;
+        return estimate;
+    }
+
+    const DecodedCoordinates coordinates(cloud);
+    std::vector<BatchSums> wave;
+    uint64_t batches = 0;
+    size_t waveSize = 8;
+    double sum = 0, sumSquares = 0;
+    while (true)
+    {
+        wave.assign(waveSize, BatchSums());
+        const uint64_t firstBatch = batches;
+        pool.parallelFor(waveSize, [&](size_t k)
+        {
+            wave[k] = sampleBatch(coordinates, n, firstBatch + k);
+        });
+        for (const BatchSums &sums : wave)
+        {
+            sum += sums.sum;
+            sumSquares += sums.sumSquares;
+        }
+        batches += waveSize;
+
+        const double samples = double(batches * kBatchSize);
+        const double mean = sum / samples;
+        const double variance = std::max(0.0, (sumSquares - sum * mean) / (samples - 1));
+        estimate.average = mean;
+        estimate.halfWidth = kConfidenceZ * std::sqrt(variance / samples);
+        estimate.samples = batches * kBatchSize;
+        if (estimate.halfWidth <= tolerance * mean || estimate.samples >= kMaxSamples)
+        {
+            break;
+        }
+
+        // The half-width shrinks with the square root of the samples; aim a little past the target
+        const double ratio = estimate.halfWidth / (tolerance * mean);
+        const double needed = samples * ratio * ratio * 1.1;
+        const double more = std::ceil((needed - samples) / kBatchSize);
+        waveSize = static_cast<size_t>(std::min(std::max(more, 1.0), double(kMaxSamples / kBatchSize - batches)));
+    }
+    Profiler::count(Profiler::DistanceEvaluations, estimate.samples);
+    return estimate;
+}
+
+ApproximateDistance::DiameterEstimate ApproximateDistance::diameter(const PointCloud &cloud, double tolerance, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    DiameterEstimate estimate;
+    if (n < 2)
+    {
+        return estimate;
+    }
+    if (n <= kExactLimit || !(tolerance > 0))
+    {
+        estimate.pair = PairSearch::farthestPair(cloud);
+        estimate.upperBound = estimate.pair.distance();
+        estimate.coresetSize = n;
+        estimate.exact = true;
+        return estimate;
+    }
+
+    const DecodedCoordinates coordinates(cloud);
+    const double r2 = std::sqrt(0.5), r3 = std::sqrt(1.0 / 3.0);
+    const std::vector<Point> seedDirections = {
+        {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {r2, r2, 0}, {r2, -r2, 0}, {r2, 0, r2}, {r2, 0, -r2},
+        {0, r2, r2}, {0, r2, -r2}, {r3, r3, r3}, {r3, r3, -r3}, {r3, -r3, r3}, {r3, -r3, -r3}};
+    searchDirections(coordinates, n, std::vector<size_t>(), seedDirections, estimate.pair, pool);
+    const double seedDistance = estimate.pair.distance();
+    if (seedDistance == 0)
+    {
+        estimate.coresetSize = n;
+        estimate.directions = seedDirections.size();
+        return estimate;
+    }
+
+    // Half of the tolerance goes to the coreset and half to the spacing of the directions
+    Point low, high;
+    cloud.bounds(0, n, low, high);
+    double cellSize = tolerance * seedDistance / (4 * std::sqrt(2.0));
+    std::vector<size_t> candidates = columnExtremes(coordinates, n, low, high, cellSize, pool);
+    if (candidates.empty())
+    {
+        cellSize = 0;
+        candidates.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            candidates[i] = i;
+        }
+    }
+
+    const double angle = std::acos(1 / (1 + tolerance / 2));
+    const size_t m = static_cast<size_t>(std::ceil(std::sqrt(2.0) / angle));
+    const double coverCosine = std::cos(std::sqrt(2.0) / double(m));
+
+    // The direction nearest the coreset's diameter has a width of at least minimumWidth, and its
+    // extreme points lie at least minimumWidth - R from the box centre, R being the largest such distance
+    const double minimumWidth = (seedDistance - 2 * std::sqrt(2.0) * cellSize) * coverCosine;
+    const Point centre{(low.x + high.x) / 2, (low.y + high.y) / 2, (low.z + high.z) / 2};
+    auto centreDistance = [&](size_t point)
+    {
+        double dx = coordinates.x()[point] - centre.x;
+        double dy = coordinates.y()[point] - centre.y;
+        double dz = coordinates.z()[point] - centre.z;
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    };
+    double radius = 0;
+    for (size_t point : candidates)
+    {
+        radius = std::max(radius, centreDistance(point));
+    }
+    const double shell = minimumWidth - radius;
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [&](size_t point) { return centreDistance(point) < shell; }),
+                     candidates.end());
+    estimate.coresetSize = candidates.size();
+
+    const std::vector<Point> directions = faceDirections(m);
+    estimate.directions = directions.size();
+    const double width = searchDirections(coordinates, n, candidates, directions, estimate.pair, pool);
+
+    estimate.upperBound = width / coverCosine + 2 * std::sqrt(2.0) * cellSize;
+    estimate.upperBound = std::max(estimate.upperBound, estimate.pair.distance());
+    return estimate;
+}
+
+ApproximateDistance::BatchSums ApproximateDistance::sampleBatch(const DecodedCoordinates &coordinates, size_t n, uint64_t batch)
+{
+    // Seeded by the batch number alone, so the samples do not depend on which thread draws them
+    std::mt19937_64 random(0x5eedULL + batch * 0x9e3779b97f4a7c15ULL);
+    std::uniform_int_distribution<size_t> pickFirst(0, n - 1), pickSecond(0, n - 2);
+    const double *xs = coordinates.x();
+    const double *ys = coordinates.y();
+    const double *zs = coordinates.z();
+    BatchSums sums;
+    for (size_t k = 0; k < kBatchSize; ++k)
+    {
+        size_t a = pickFirst(random);
+        size_t b = pickSecond(random);
+        b += b >= a ? 1 : 0;
+        double dx = xs[a] - xs[b];
+        double dy = ys[a] - ys[b];
+        double dz = zs[a] - zs[b];
+        double distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+        sums.sum += distance;
+        sums.sumSquares += distance * distance;
+    }
+    return sums;
+}
+
+double ApproximateDistance::searchDirections(const DecodedCoordinates &coordinates, size_t pointCount,
+                                             const std::vector<size_t> &candidates, const std::vector<Point> &directions,
+                                             PointPair &best, ThreadPool &pool)
+{
+    struct Extremes
+    {
+        double low, high;
+        size_t lowPosition, highPosition;
+    };
+
+    // An empty candidate list stands for every point
+    const double *xs = coordinates.x();
+    const double *ys = coordinates.y();
+    const double *zs = coordinates.z();
+    const size_t count = candidates.empty() ? pointCount : candidates.size();
+    auto pointAt = [&](size_t position) { return candidates.empty() ? position : candidates[position]; };
+
+    const size_t blocks = (count + kBlockSize - 1) / kBlockSize;
+    std::vector<Extremes> blockExtremes(blocks * directions.size());
+    pool.parallelFor(blocks, [&](size_t block)
+    {
+        const size_t begin = block * kBlockSize;
+        const size_t end = std::min(count, begin + kBlockSize);
+        double x[kBlockSize], y[kBlockSize], z[kBlockSize];
+        for (size_t position = begin; position < end; ++position)
+        {
+            const size_t point = pointAt(position);
+            x[position - begin] = xs[point];
+            y[position - begin] = ys[point];
+            z[position - begin] = zs[point];
+        }
+        for (size_t d = 0; d < directions.size(); ++d)
+        {
+            const Point &direction = directions[d];
+            Extremes extremes{HUGE_VAL, -HUGE_VAL, begin, begin};
+            for (size_t k = 0; k < end - begin; ++k)
+            {
+                double value = direction.x * x[k] + direction.y * y[k] + direction.z * z[k];
+                if (value < extremes.low)
+                {
+                    extremes.low = value;
+                    extremes.lowPosition = begin + k;
+                }
+                if (value > extremes.high)
+                {
+                    extremes.high = value;
+                    extremes.highPosition = begin + k;
+                }
+            }
+            blockExtremes[block * directions.size() + d] = extremes;
+        }
+    });
+
+    double width = 0;
+    for (size_t d = 0; d < directions.size(); ++d)
+    {
+        Extremes extremes = blockExtremes[d];
+        for (size_t block = 1; block < blocks; ++block)
+        {
+            const Extremes &other = blockExtremes[block * directions.size() + d];
+            if (other.low < extremes.low)
+            {
+                extremes.low = other.low;
+                extremes.lowPosition = other.lowPosition;
+            }
+            if (other.high > extremes.high)
+            {
+                extremes.high = other.high;
+                extremes.highPosition = other.highPosition;
+            }
+        }
+        width = std::max(width, extremes.high - extremes.low);
+
+        size_t a = pointAt(extremes.lowPosition), b = pointAt(extremes.highPosition);
+        if (a > b)
+        {
+            std::swap(a, b);
+        }
+        double dx = xs[a] - xs[b];
+        double dy = ys[a] - ys[b];
+        double dz = zs[a] - zs[b];
+        double distanceSquared = dx * dx + dy * dy + dz * dz;
+        if (!best.found || distanceSquared > best.distanceSquared ||
+            (distanceSquared == best.distanceSquared && (a < best.first || (a == best.first && b < best.second))))
+        {
+            best.first = a;
+            best.second = b;
+            best.distanceSquared = distanceSquared;
+            best.found = true;
+        }
+    }
+    return width;
+}
+
+std::vector<size_t> ApproximateDistance::columnExtremes(const DecodedCoordinates &coordinates, size_t n, const Point &low,
+                                                        const Point &high, double cellSize, ThreadPool &pool)
+{
+    const double columnsX = std::floor((high.x - low.x) / cellSize) + 1;
+    const double columnsY = std::floor((high.y - low.y) / cellSize) + 1;
+
+    // No coreset when it would not be much smaller than the cloud
+    if (!(columnsX * columnsY <= double(kMaxColumns)) || 2 * columnsX * columnsY >= double(n))
+    {
+        return std::vector<size_t>();
+    }
+    const size_t width = static_cast<size_t>(columnsX);
+    const size_t columns = width * static_cast<size_t>(columnsY);
+    const double *xs = coordinates.x();
+    const double *ys = coordinates.y();
+    const double *zs = coordinates.z();
+
+    // Every lane scans one slice of the cloud into its own grid, then the grids are merged in lane order
+    const size_t lanes = std::min(pool.size() + 1, (n + kChunkSize - 1) / kChunkSize);
+    std::vector<std::vector<size_t>> lowest(lanes), highest(lanes);
+    pool.parallelFor(lanes, [&](size_t lane)
+    {
+        lowest[lane].assign(columns, kNone);
+        highest[lane].assign(columns, kNone);
+        const size_t end = n * (lane + 1) / lanes;
+        for (size_t i = n * lane / lanes; i < end; ++i)
+        {
+            size_t cx = std::min(width - 1, static_cast<size_t>(std::max(0.0, (xs[i] - low.x) / cellSize)));
+            size_t cy = std::min(columns / width - 1, static_cast<size_t>(std::max(0.0, (ys[i] - low.y) / cellSize)));
+            size_t column = cx + cy * width;
+            if (lowest[lane][column] == kNone || zs[i] < zs[lowest[lane][column]])
+            {
+                lowest[lane][column] = i;
+            }
+            if (highest[lane][column] == kNone || zs[i] > zs[highest[lane][column]])
+            {
+                highest[lane][column] = i;
+            }
+        }
+    });
+
+    std::vector<size_t> candidates;
+    for (size_t column = 0; column < columns; ++column)
+    {
+        size_t bottom = kNone, top = kNone;
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            size_t point = lowest[lane][column];
+            if (point != kNone && (bottom == kNone || zs[point] < zs[bottom]))
+            {
+                bottom = point;
+            }
+            point = highest[lane][column];
+            if (point != kNone && (top == kNone || zs[point] > zs[top]))
+            {
+                top = point;
+            }
+        }
+        if (bottom != kNone)
+        {
+            candidates.push_back(bottom);
+        }
+        if (top != kNone && top != bottom)
+        {
+            candidates.push_back(top);
+        }
+    }
+    return candidates;
+}
+
+std::vector<Point> ApproximateDistance::faceDirections(size_t m)
+{
+    // Every direction or its opposite meets one of the three faces within sqrt(2) / m of a cell centre
+    std::vector<Point> directions;
+    directions.reserve(3 * m * m);
+    for (int face = 0; face < 3; ++face)
+    {
+        for (size_t i = 0; i < m; ++i)
+        {
+            for (size_t j = 0; j < m; ++j)
+            {
+                double s = -1 + (2 * i + 1) / double(m);
+                double t = -1 + (2 * j + 1) / double(m);
+                double length = std::sqrt(1 + s * s + t * t);
+                double u = 1 / length, v = s / length, w = t / length;
+                directions.push_back(face == 0 ? Point{u, v, w} : face == 1 ? Point{w, u, v} : Point{v, w, u});
+            }
+        }
+    }
+    return directions;
+}
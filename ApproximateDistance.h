@@ -0,0 +1,116 @@
+#ifndef APPROXIMATE_DISTANCE_H
+#define APPROXIMATE_DISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PairSearch.h"
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Fast estimates of the average distance and the diameter with error bounds.
+ *
+ * Both take a relative tolerance, and their cost depends on it rather than
+ * growing with n^2. Small clouds, and a tolerance of 0, are answered exactly.
+ *
+ * The average distance is estimated from uniformly sampled pairs. Pairs
+ * are drawn in batches until the 95% confidence interval of the mean is
+ * within the tolerance of it. Every batch has its own seed and the batch
+ * sums are combined in batch order, so the estimate does not depend on
+ * the thread count.
+ *
+ * The diameter is bounded from below and above. A first pass finds the
+ * extreme points along 13 directions, which give a lower bound L0. The
+ * cloud is then reduced to a coreset: the highest and lowest point of
+ * every vertical column of an xy grid with cells of c = tol * L0 / (4 sqrt 2).
+ * Any width of the cloud shrinks by at most 2 sqrt(2) c on the coreset.
+ * The coreset's extreme points are then found along directions through
+ * the cell centres of an m x m grid on three cube faces, which leave no
+ * direction more than an angle sqrt(2) / m away. Only coreset points far
+ * enough from the box centre to be extreme along the direction nearest the
+ * diameter take part. With W the largest width found, the diameter D satisfies
+ *
+ *     L <= D <= W / cos(sqrt(2) / m) + 2 sqrt(2) c
+ *
+ * where L, the distance of the farthest pair of extreme points, is also
+ * returned as the pair. m and c are chosen so that the upper bound is
+ * within the tolerance of L.
+ */
+class ApproximateDistance
+{
+public:
+    struct AverageEstimate
+    {
+        double average = 0;
+        double halfWidth = 0;  // Of the 95% confidence interval, 0 when exact
+        uint64_t samples = 0;  // Pairs measured
+        bool exact = false;
+    };
+
+    struct DiameterEstimate
+    {
+        PointPair pair;         // Farthest pair found, a lower bound on the diameter
+        double upperBound = 0;  // The diameter is at most this
+        size_t coresetSize = 0; // Points whose extremes were searched
+        size_t directions = 0;
+        bool exact = false;
+    };
+
+    /**
+     * @brief Estimates the mean pairwise distance to within @p tolerance of itself, at 95% confidence.
+     */
+    static AverageEstimate average(const PointCloud &cloud, double tolerance, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Farthest pair with an upper bound on the diameter within @p tolerance of its distance.
+     */
+    static DiameterEstimate diameter(const PointCloud &cloud, double tolerance, ThreadPool &pool = ThreadPool::shared());
+
+    static constexpr double kConfidenceZ = 1.959963984540054; // Two-sided 95%
+
+private:
+    struct BatchSums
+    {
+        double sum = 0;
+        double sumSquares = 0;
+    };
+
+    static BatchSums sampleBatch(const DecodedCoordinates &coordinates, size_t n, uint64_t batch);
+
+    /**
+     * @brief Extreme points of @p candidates along @p directions; widens @p best and returns the largest width.
+     *
+     * An empty @p candidates stands for all @p pointCount points.
+     */
+    static double searchDirections(const DecodedCoordinates &coordinates, size_t pointCount,
+                                   const std::vector<size_t> &candidates, const std::vector<Point> &directions,
+                                   PointPair &best, ThreadPool &pool);
+
+    /**
+     * @brief The highest and lowest point of every column of an xy grid with cells of @p cellSize.
+     *
+     * Empty when the grid would have too many columns to make the coreset much smaller than the cloud.
+     */
+    static std::vector<size_t> columnExtremes(const DecodedCoordinates &coordinates, size_t n, const Point &low,
+                                              const Point &high, double cellSize, ThreadPool &pool);
+
+    /**
+     * @brief Unit directions through the cell centres of an @p m x @p m grid on the +x, +y and +z cube faces.
+     */
+    static std::vector<Point> faceDirections(size_t m);
+
+    static constexpr size_t kNone = ~size_t(0);
+
+    // Clouds up to this size are answered exactly
+    static constexpr size_t kExactLimit = 2048;
+    static constexpr size_t kBatchSize = 4096;
+    static constexpr uint64_t kMaxSamples = uint64_t(1) << 32;
+    static constexpr size_t kMaxColumns = size_t(1) << 20;
+
+    // Points per chunk of the passes over the cloud, and per block of the direction search
+    static constexpr size_t kChunkSize = size_t(1) << 16;
+    static constexpr size_t kBlockSize = size_t(1) << 12;
+};
+
+#endif // APPROXIMATE_DISTANCE_H
@@ -0,0 +1,220 @@
+#include "AverageDistance.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AVERAGE_DISTANCE_X86 1
+#endif
+
+namespace
+{
+    // Sum of the distances from (x, y, z) to the count points starting at xs, ys, zs
+    typedef double (*RowKernel)(double x, double y, double z,
+                                const double *xs, const double *ys, const double *zs, size_t count);
+
+    double rowSumScalar(double x, double y, double z,
+                        const double *xs, const double *ys, const double *zs, size_t count)
+    {
+        double sum = 0;
+        for (size_t j = 0; j < count; ++j)
+        {
+            double dx = xs[j] - x;
+            double dy = ys[j] - y;
+            double dz = zs[j] - z;
+            sum += std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+        return sum;
+    }
+
+#ifdef AVERAGE_DISTANCE_X86
+    __attribute__((target("avx2")))
+    double rowSumAvx2(double x, double y, double z,
+                      const double *xs, const double *ys, const double *zs, size_t count)
+    {
+        const __m256d px = _mm256_set1_pd(x);
+        const __m256d py = _mm256_set1_pd(y);
+        const __m256d pz = _mm256_set1_pd(z);
+        __m256d lanes = _mm256_setzero_pd();
+        size_t j = 0;
+        for (; j + 4 <= count; j += 4)
+        {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + j), px);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + j), py);
+            __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(zs + j), pz);
+            __m256d squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                            _mm256_mul_pd(dz, dz));
+            lanes = _mm256_add_pd(lanes, _mm256_sqrt_pd(squared));
+        }
+        double lane[4];
+        _mm256_storeu_pd(lane, lanes);
+        return (lane[0] + lane[1]) + (lane[2] + lane[3]) + rowSumScalar(x, y, z, xs + j, ys + j, zs + j, count - j);
+    }
+
+    __attribute__((target("avx512f")))
+    double rowSumAvx512(double x, double y, double z,
+                        const double *xs, const double *ys, const double *zs, size_t count)
+    {
+        const __m512d px = _mm512_set1_pd(x);
+        const __m512d py = _mm512_set1_pd(y);
+        const __m512d pz = _mm512_set1_pd(z);
+        __m512d lanes = _mm512_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= count; j += 8)
+        {
+            __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(xs + j), px);
+            __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(ys + j), py);
+            __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(zs + j), pz);
+            __m512d squared = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+                                            _mm512_mul_pd(dz, dz));
+            // Zero-masked over all lanes; the plain intrinsic reads an undefined vector that GCC warns about
+            lanes = _mm512_add_pd(lanes, _mm512_maskz_sqrt_pd(0xFF, squared));
+        }
+        double lane[8];
+        _mm512_storeu_pd(lane, lanes);
+        return ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7])) +
+               rowSumScalar(x, y, z, xs + j, ys + j, zs + j, count - j);
+    }
+#endif
+
+    RowKernel selectKernel(const char **name)
+    {
+#ifdef AVERAGE_DISTANCE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            *name = "avx512";
+            return rowSumAvx512;
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            *name = "avx2";
+            return rowSumAvx2;
+        }
+#endif
+        *name = "scalar";
+        return rowSumScalar;
+    }
+
+    const char *gKernelName = nullptr;
+    const RowKernel gRowKernel = selectKernel(&gKernelName);
+
+    // Neumaier's compensated sum, so adding millions of row sums loses no precision
+    struct CompensatedSum
+    {
+        double sum = 0;
+        double compensation = 0;
+
+        void add(double value)
+        {
+            double total = sum + value;
+            if (std::fabs(sum) >= std::fabs(value))
+            {
+                compensation += (sum - total) + value;
+            }
+            else
+            {
+                compensation += (value - total) + sum;
+            }
+            sum = total;
+        }
+        double value() const { return sum + compensation; }
+    };
+}
+
+AverageDistance::Result AverageDistance::compute(const PointCloud &cloud, ThreadPool &pool)
+{
+    return computeAppended(cloud, 0, pool);
+}
+
+AverageDistance::Result AverageDistance::computeAppended(const PointCloud &cloud, size_t firstNew, ThreadPool &pool)
+{
+    Result result;
+    const size_t n = cloud.size();
+    if (n < 2 || firstNew >= n)
+    {
+        return result;
+    }
+    result.pairCount = uint64_t(n) * (n - 1) / 2 - uint64_t(firstNew) * (firstNew - (firstNew > 0)) / 2;
+
+    // Compact clouds are decoded a tile at a time, double clouds are read in place
+    const bool decodeTiles = cloud.storage() != PointCloud::Storage::Double;
+    const double *xs = cloud.xData();
+    const double *ys = cloud.yData();
+    const double *zs = cloud.zData();
+
+    // Tile (row, column) with column >= row; columns that end before firstNew
+    // hold no new pair. Each tile row is cut into kSegmentsPerRow runs of
+    // columns, one task each, so there are O(n / kTileSize) partial sums
+    const size_t tilesPerSide = (n + kTileSize - 1) / kTileSize;
+    const size_t firstColumn = firstNew / kTileSize;
+    PointCloud::Array<double> segmentSums(tilesPerSide * kSegmentsPerRow, 0.0, cloud.allocator<double>());
+
+    auto sumTile = [&](size_t row, size_t column, CompensatedSum &sum)
+    {
+        const size_t rowBegin = row * kTileSize;
+        const size_t rowEnd = std::min(rowBegin + kTileSize, n);
+        const size_t columnBegin = column * kTileSize;
+        const size_t columnEnd = std::min(columnBegin + kTileSize, n);
+
+        // Row i and column j live at rows[i - rowBase] and columns[j - columnBase]
+        const double *rowX = xs, *rowY = ys, *rowZ = zs;
+        const double *columnX = xs, *columnY = ys, *columnZ = zs;
+        size_t rowBase = 0, columnBase = 0;
+        double rowTile[3][kTileSize], columnTile[3][kTileSize];
+        if (decodeTiles)
+        {
+            cloud.decode(rowBegin, rowEnd, rowTile[0], rowTile[1], rowTile[2]);
+            cloud.decode(columnBegin, columnEnd, columnTile[0], columnTile[1], columnTile[2]);
+            rowX = rowTile[0];
+            rowY = rowTile[1];
+            rowZ = rowTile[2];
+            columnX = columnTile[0];
+            columnY = columnTile[1];
+            columnZ = columnTile[2];
+            rowBase = rowBegin;
+            columnBase = columnBegin;
+        }
+
+        for (size_t i = rowBegin; i < rowEnd; ++i)
+        {
+            // On the diagonal only the pairs with j > i belong to this tile
+            size_t first = std::max(std::max(columnBegin, i + 1), firstNew);
+            if (first < columnEnd)
+            {
+                size_t r = i - rowBase, c = first - columnBase;
+                sum.add(gRowKernel(rowX[r], rowY[r], rowZ[r],
+                                   columnX + c, columnY + c, columnZ + c, columnEnd - first));
+            }
+        }
+    };
+
+    // Segment s of a row takes every kSegmentsPerRow-th tile starting at column s,
+    // which balances the long rows near the top against the short ones below
+    pool.parallelFor(segmentSums.size(), [&](size_t task)
+    {
+        const size_t row = task / kSegmentsPerRow;
+        const size_t segment = task % kSegmentsPerRow;
+        CompensatedSum sum;
+        for (size_t column = std::max(row, firstColumn) + segment; column < tilesPerSide; column += kSegmentsPerRow)
+        {
+            sumTile(row, column, sum);
+        }
+        segmentSums[task] = sum.value();
+    });
+
+    CompensatedSum total;
+    for (double segmentSum : segmentSums)
+    {
+        total.add(segmentSum);
+    }
+    result.totalDistance = total.value();
+    Profiler::count(Profiler::DistanceEvaluations, result.pairCount);
+    return result;
+}
+
+const char *AverageDistance::kernelName()
+{
+    return gKernelName;
+}
@@ -0,0 +1,56 @@
+#ifndef AVERAGE_DISTANCE_H
+#define AVERAGE_DISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Exact mean of the distances between all pairs of points of a cloud.
+ *
+ * The pairs are cut into square tiles of kTileSize x kTileSize points, small
+ * enough that both tiles stay in L1. Each tile is summed by one thread with
+ * a vectorized row kernel (AVX-512, AVX2 or scalar, picked at runtime). The
+ * tiles of a tile row are shared among kSegmentsPerRow tasks, each keeping a
+ * compensated sum, and the task sums are combined in task order, so only
+ * O(n / kTileSize) partial sums are stored. Because the split does not
+ * depend on the thread count, the result is bit-for-bit the same however
+ * many threads run.
+ */
+class AverageDistance
+{
+public:
+    struct Result
+    {
+        double totalDistance = 0;
+        uint64_t pairCount = 0;
+
+        double average() const { return pairCount > 0 ? totalDistance / pairCount : 0; }
+    };
+
+    static constexpr size_t kTileSize = 256;
+
+    // Tasks per tile row
+    static constexpr size_t kSegmentsPerRow = 8;
+
+    /**
+     * @brief Sums all pairwise distances of @p cloud, spreading the tiles over @p pool.
+     */
+    static Result compute(const PointCloud &cloud, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Sums only the pairs of @p cloud that include a point at index @p firstNew or later.
+     *
+     * Adding this to the result for the first @p firstNew points gives the
+     * result for the whole cloud, so appended points cost O(appended * n).
+     */
+    static Result computeAppended(const PointCloud &cloud, size_t firstNew, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Name of the row kernel this CPU uses ("avx512", "avx2" or "scalar").
+     */
+    static const char *kernelName();
+};
+
+#endif // AVERAGE_DISTANCE_H
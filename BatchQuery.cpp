@@ -0,0 +1,335 @@
+#include "BatchQuery.h"
+#include "BinaryPointFile.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include "SpatialOrder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+    Point queryCentre(const BatchQuery::Query &query)
+    {
+        if (query.type == BatchQuery::Query::Box)
+        {
+            return Point{(query.low.x + query.high.x) / 2, (query.low.y + query.high.y) / 2, (query.low.z + query.high.z) / 2};
+        }
+        return query.low;
+    }
+
+    void storeUint(uint64_t value, size_t bytes, std::ostream &out)
+    {
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    void storeDouble(double value, std::ostream &out)
+    {
+        unsigned char bytes[8];
+        BinaryPointFile::storeDouble(value, bytes);
+        out.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+    }
+}
+
+bool BatchQuery::parseQueries(const std::string &filename, std::vector<Query> &queries, std::ostream &errors)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        errors << "Error opening query file: " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (size_t lineNumber = 1; getline(file, line); ++lineNumber)
+    {
+        std::istringstream iss(line);
+        std::string type;
+        if (!(iss >> type) || type[0] == '#')
+        {
+            continue;
+        }
+
+        Query query;
+        if (!parseQuery(line, query))
+        {
+            errors << "Error in query file " << filename << ":" << lineNumber << ": Invalid query." << std::endl;
+            return false;
+        }
+        query.line = lineNumber;
+        queries.push_back(query);
+    }
+    return true;
+}
+
+bool BatchQuery::parseQuery(const std::string &line, Query &query)
+{
+    std::istringstream iss(line);
+    std::string type;
+    iss >> type;
+    bool parsed = false;
+    if (type == "sphere")
+    {
+        double diameter;
+        query.type = Query::Sphere;
+        parsed = static_cast<bool>(iss >> query.low.x >> query.low.y >> query.low.z >> diameter) && diameter >= 0;
+        query.radius = diameter / 2.0;
+    }
+    else if (type == "box")
+    {
+        query.type = Query::Box;
+        parsed = static_cast<bool>(iss >> query.low.x >> query.low.y >> query.low.z
+                                       >> query.high.x >> query.high.y >> query.high.z);
+    }
+    else if (type == "color")
+    {
+        int rgb[6];
+        query.type = Query::Color;
+        parsed = static_cast<bool>(iss >> rgb[0] >> rgb[1] >> rgb[2] >> rgb[3] >> rgb[4] >> rgb[5]);
+        for (int channel = 0; parsed && channel < 6; ++channel)
+        {
+            parsed = rgb[channel] >= 0 && rgb[channel] <= 255;
+        }
+        for (int channel = 0; parsed && channel < 3; ++channel)
+        {
+            query.minRgb[channel] = static_cast<unsigned char>(rgb[channel]);
+            query.maxRgb[channel] = static_cast<unsigned char>(rgb[channel + 3]);
+        }
+    }
+    else if (type == "knn")
+    {
+        long long k;
+        query.type = Query::Nearest;
+        parsed = static_cast<bool>(iss >> query.low.x >> query.low.y >> query.low.z >> k) && k > 0;
+        query.k = parsed ? static_cast<size_t>(k) : 0;
+    }
+
+    std::string rest;
+    return parsed && !(iss >> rest);
+}
+
+void BatchQuery::run(const std::vector<std::string> &files, const std::vector<Query> &queries,
+                     PointCloudCache &cache, std::ostream &out, bool binary)
+{
+    const std::vector<size_t> order = mortonOrder(queries);
+
+    // Without a memory budget the files are loaded and indexed in parallel. Under one
+    // they would compete for it, so each is loaded when its turn comes and released
+    // after its hits are written, leaving the whole budget to every file.
+    const bool budgeted = MemoryBudget::limit() != 0;
+    std::vector<std::shared_ptr<const KDTree>> indexes(files.size());
+    if (!budgeted)
+    {
+        ThreadPool::shared().parallelFor(files.size(), [&](size_t file)
+        {
+            indexes[file] = cache.getIndex(files[file]);
+        });
+    }
+
+    if (binary)
+    {
+        writeBinaryHeader(files, out);
+    }
+    else
+    {
+        out << "query,file,index,x,y,z,distance\n";
+    }
+
+    // results[query] holds the hits of one query on the current file, written before the next file runs
+    std::vector<std::vector<Hit>> results;
+    for (size_t file = 0; file < files.size(); ++file)
+    {
+        if (budgeted)
+        {
+            indexes[file] = cache.getIndex(files[file]);
+        }
+        if (!indexes[file] && cache.exceedsBudget(files[file]))
+        {
+            std::cerr << "Error: File " << files[file] << " does not fit in the memory budget and will not be queried." << std::endl;
+            continue;
+        }
+        if (!indexes[file])
+        {
+            std::cerr << "Could not open file: " << files[file] << std::endl;
+            continue;
+        }
+        const KDTree &index = *indexes[file];
+        results.assign(queries.size(), std::vector<Hit>());
+        {
+            Profiler::Scope scope(files[file], "batch_query");
+            ThreadPool::shared().parallelFor(order.size(), [&](size_t position)
+            {
+                size_t query = order[position];
+                execute(index, queries[query], results[query]);
+            });
+
+            uint64_t hits = 0;
+            for (const std::vector<Hit> &queryHits : results)
+            {
+                hits += queryHits.size();
+            }
+            Profiler::count(Profiler::QueryHits, hits);
+        }
+
+        Profiler::Scope scope(files[file], "write_results");
+        if (binary)
+        {
+            writeBinary(file, index.cloud(), results, out);
+        }
+        else
+        {
+            writeCsv(files[file], index.cloud(), results, out);
+        }
+        indexes[file].reset();
+    }
+    out.flush();
+}
+
+std::vector<size_t> BatchQuery::mortonOrder(const std::vector<Query> &queries)
+{
+    std::vector<size_t> order(queries.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    if (queries.size() < 2)
+    {
+        return order;
+    }
+
+    // Quantize the centres to 21 bits per axis over their bounding box; colour queries have none and go first
+    Point low{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    Point high{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    for (const Query &query : queries)
+    {
+        if (query.type == Query::Color)
+        {
+            continue;
+        }
+        Point centre = queryCentre(query);
+        low = Point{std::min(low.x, centre.x), std::min(low.y, centre.y), std::min(low.z, centre.z)};
+        high = Point{std::max(high.x, centre.x), std::max(high.y, centre.y), std::max(high.z, centre.z)};
+    }
+    const double extent = std::max(std::max(high.x - low.x, high.y - low.y), high.z - low.z);
+    const double scale = extent > 0 ? double(0x1fffff) / extent : 0;
+
+    std::vector<uint64_t> keys(queries.size(), 0);
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        if (queries[i].type == Query::Color)
+        {
+            continue;
+        }
+        Point centre = queryCentre(queries[i]);
+        keys[i] = SpatialOrder::mortonCode(static_cast<uint32_t>((centre.x - low.x) * scale),
+                                           static_cast<uint32_t>((centre.y - low.y) * scale),
+                                           static_cast<uint32_t>((centre.z - low.z) * scale));
+    }
+    std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    return order;
+}
+
+void BatchQuery::execute(const KDTree &index, const Query &query, std::vector<Hit> &hits)
+{
+    if (query.type == Query::Nearest)
+    {
+        for (const std::pair<double, size_t> &neighbour : index.nearest(query.low, query.k))
+        {
+            hits.push_back(Hit{neighbour.second, std::sqrt(neighbour.first)});
+        }
+        return;
+    }
+
+    std::vector<size_t> found;
+    if (query.type == Query::Color)
+    {
+        found = index.cloud().selectByColor(query.minRgb, query.maxRgb);
+    }
+    else if (query.type == Query::Sphere)
+    {
+        index.sphereQuery(query.low, query.radius, found);
+    }
+    else
+    {
+        index.boxQuery(query.low, query.high, found);
+    }
+    // Hits in file order, the tree and reordered clouds return them in tree or curve order
+    index.cloud().sortBySource(found);
+    hits.reserve(found.size());
+    for (size_t point : found)
+    {
+        hits.push_back(Hit{point, std::numeric_limits<double>::quiet_NaN()});
+    }
+}
+
+void BatchQuery::writeCsv(const std::string &filename, const PointCloud &cloud,
+                          const std::vector<std::vector<Hit>> &results, std::ostream &out)
+{
+    // Paths may hold commas and quotes, so the file column is always quoted
+    std::string quoted = "\"";
+    for (char c : filename)
+    {
+        quoted += c;
+        if (c == '"')
+        {
+            quoted += '"';
+        }
+    }
+    quoted += '"';
+
+    // Enough digits that every coordinate reads back exactly
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    for (size_t query = 0; query < results.size(); ++query)
+    {
+        for (const Hit &hit : results[query])
+        {
+            Point point = cloud[hit.index];
+            out << query << ',' << quoted << ',' << cloud.sourceIndex(hit.index) << ','
+                << point.x << ',' << point.y << ',' << point.z << ',';
+            if (hit.distance == hit.distance)
+            {
+                out << hit.distance;
+            }
+            out << '\n';
+        }
+    }
+    out << std::setprecision(6);
+}
+
+void BatchQuery::writeBinaryHeader(const std::vector<std::string> &files, std::ostream &out)
+{
+    out.write("PTQR", 4);
+    storeUint(1, 4, out);
+    storeUint(files.size(), 4, out);
+    for (const std::string &file : files)
+    {
+        storeUint(file.size(), 4, out);
+        out.write(file.data(), file.size());
+    }
+}
+
+void BatchQuery::writeBinary(size_t file, const PointCloud &cloud, const std::vector<std::vector<Hit>> &results, std::ostream &out)
+{
+    for (size_t query = 0; query < results.size(); ++query)
+    {
+        for (const Hit &hit : results[query])
+        {
+            Point point = cloud[hit.index];
+            storeUint(query, 4, out);
+            storeUint(file, 4, out);
+            storeUint(cloud.sourceIndex(hit.index), 8, out);
+            storeDouble(point.x, out);
+            storeDouble(point.y, out);
+            storeDouble(point.z, out);
+            storeDouble(hit.distance, out);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef BATCH_QUERY_H
+#define BATCH_QUERY_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Point.h"
+#include "PointCloudCache.h"
+
+/**
+ * @brief Runs a file of sphere, box and nearest-neighbour queries against point files.
+ *
+ * The query file holds one query per line, blank lines and lines starting
+ * with '#' are skipped:
+ *
+ *     sphere <x> <y> <z> <diameter>
+ *     box <min x> <min y> <min z> <max x> <max y> <max z>
+ *     knn <x> <y> <z> <k>
+ *     color <min r> <min g> <min b> <max r> <max g> <max b>
+ *
+ * Colour queries select the points of RGB files whose channels lie within
+ * the inclusive ranges (0 to 255); files without colour have no hits.
+ *
+ * The files are loaded and indexed once through the PointCloudCache, in
+ * parallel on the shared ThreadPool, or one at a time when a MemoryBudget is
+ * set so that they do not compete for it. The queries of a file are executed in
+ * Morton order of their centres, so consecutive queries walk the same
+ * KD-tree nodes, and are spread over the pool. The hits of each file are
+ * written as soon as its queries finish, so results come in file order,
+ * then query order, and only one file's hits are held at a time.
+ */
+class BatchQuery
+{
+public:
+    struct Query
+    {
+        enum Type
+        {
+            Sphere,
+            Box,
+            Nearest,
+            Color
+        };
+
+        Type type = Sphere;
+        Point low{0, 0, 0};  // Sphere and knn centre, box minimum
+        Point high{0, 0, 0}; // Box maximum
+        double radius = 0;
+        size_t k = 0;
+        unsigned char minRgb[3] = {0, 0, 0};       // Colour range, inclusive
+        unsigned char maxRgb[3] = {255, 255, 255};
+        size_t line = 0; // Line of the query file, for messages
+    };
+
+    struct Hit
+    {
+        size_t index;    // Point of the cloud; written out as its source row
+        double distance; // Distance to the query centre, only meaningful for knn
+    };
+
+    /**
+     * @brief Reads all queries of @p filename.
+     *
+     * @return false, after writing the reason to @p errors, if the file
+     *         cannot be read or a line is not a valid query.
+     */
+    static bool parseQueries(const std::string &filename, std::vector<Query> &queries, std::ostream &errors);
+
+    /**
+     * @brief Parses one query line in the query file syntax.
+     *
+     * @return false if @p line is not a valid query.
+     */
+    static bool parseQuery(const std::string &line, Query &query);
+
+    /**
+     * @brief Runs @p query against @p index; sphere, box and colour hits come out in file order.
+     */
+    static void execute(const KDTree &index, const Query &query, std::vector<Hit> &hits);
+
+    /**
+     * @brief Executes every query against every file and writes the results to @p out.
+     *
+     * CSV has the columns query,file,index,x,y,z,distance, with the file
+     * name in double quotes and an empty distance for all but knn hits.
+     * The binary form is described in writeBinaryHeader().
+     */
+    static void run(const std::vector<std::string> &files, const std::vector<Query> &queries,
+                    PointCloudCache &cache, std::ostream &out, bool binary);
+
+private:
+    static std::vector<size_t> mortonOrder(const std::vector<Query> &queries);
+
+    static void writeCsv(const std::string &filename, const PointCloud &cloud,
+                         const std::vector<std::vector<Hit>> &results, std::ostream &out);
+
+    /**
+     * @brief Writes the header of the little-endian binary results.
+     *
+     * "PTQR" magic, uint32 version 1, uint32 file count, then per file a
+     * uint32 name length and the name bytes. writeBinary() then appends one
+     * 48-byte record per hit: uint32 query, uint32 file, uint64 index,
+     * double x, y, z and distance (NaN for all but knn hits).
+     */
+    static void writeBinaryHeader(const std::vector<std::string> &files, std::ostream &out);
+    static void writeBinary(size_t file, const PointCloud &cloud, const std::vector<std::vector<Hit>> &results, std::ostream &out);
+};
+
+#endif // BATCH_QUERY_H
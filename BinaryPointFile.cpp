@@ -0,0 +1,192 @@
+#include "BinaryPointFile.h"
+#include <cstdio>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+BinaryPointFile::~BinaryPointFile()
+{
+    close();
+}
+
+bool BinaryPointFile::open(const std::string &filename)
+{
+    close();
+
+    PointFileHeader header;
+    if (!PointLoader::readHeader(filename, header) || !header.binary)
+    {
+        return false;
+    }
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !hasExpectedSize(header, static_cast<size_t>(info.st_size)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps its own reference to the file
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+    mapping_ = static_cast<const unsigned char *>(mapping);
+    mappingSize_ = info.st_size;
+    records_ = mapping_ + header.dataOffset;
+    pointCount_ = header.pointCount;
+    hasColor_ = header.hasColor;
+    return true;
+}
+
+void BinaryPointFile::close()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(const_cast<unsigned char *>(mapping_), mappingSize_);
+    }
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+    records_ = nullptr;
+    pointCount_ = 0;
+    hasColor_ = false;
+}
+
+Point BinaryPointFile::point(size_t index) const
+{
+    const unsigned char *record = records_ + index * recordSize(hasColor_);
+    return Point{loadDouble(record), loadDouble(record + 8), loadDouble(record + 16)};
+}
+
+void BinaryPointFile::color(size_t index, unsigned char rgb[3]) const
+{
+    const unsigned char *record = records_ + index * recordSize(hasColor_);
+    rgb[0] = record[24];
+    rgb[1] = record[25];
+    rgb[2] = record[26];
+}
+
+size_t BinaryPointFile::recordSize(bool hasColor)
+{
+    return 3 * sizeof(double) + (hasColor ? 3 : 0);
+}
+
+bool BinaryPointFile::hasExpectedSize(const PointFileHeader &header, size_t fileSize)
+{
+    return header.dataOffset <= fileSize &&
+           fileSize - header.dataOffset == static_cast<size_t>(header.pointCount) * recordSize(header.hasColor);
+}
+
+bool BinaryPointFile::loadPoints(const std::string &filename, PointCloud &cloud)
+{
+    BinaryPointFile file;
+    if (!file.open(filename))
+    {
+        return false;
+    }
+
+    cloud.reserve(file.size(), file.hasColor());
+    for (size_t i = 0; i < file.size(); ++i)
+    {
+        unsigned char rgb[3] = {0, 0, 0};
+        if (file.hasColor())
+        {
+            file.color(i, rgb);
+        }
+        cloud.add(file.point(i), PointCloud::packColor(rgb[0], rgb[1], rgb[2]));
+    }
+    return true;
+}
+
+bool BinaryPointFile::convertFromAscii(const std::string &input, const std::string &output)
+{
+    PointFileHeader header;
+    if (!PointLoader::readHeader(input, header) || header.binary || header.pointCount <= 0)
+    {
+        return false;
+    }
+
+    std::FILE *out = std::fopen(output.c_str(), "wb");
+    if (out == nullptr)
+    {
+        return false;
+    }
+    std::fprintf(out, "VERSION 1\nFORMAT %s\nPOINTS %d\nDATA binary\n",
+                 header.hasColor ? "x y z r g b" : "x y z", header.pointCount);
+
+    // Rows are parsed by the loader's own parser into a reused chunk, outside the memory budget
+    const size_t record = recordSize(header.hasColor);
+    PointCloud chunk(std::make_shared<MemoryBudget::Account>(false));
+    chunk.reserve(kConvertChunk, header.hasColor);
+    std::vector<unsigned char> buffer(kConvertChunk * record);
+    int rows = 0;
+    bool writeOk = true;
+    auto writeChunk = [&]()
+    {
+        for (size_t i = 0; i < chunk.size(); ++i)
+        {
+            unsigned char *target = &buffer[i * record];
+            const Point point = chunk[i];
+            storeDouble(point.x, target);
+            storeDouble(point.y, target + 8);
+            storeDouble(point.z, target + 16);
+            if (header.hasColor)
+            {
+                PointCloud::unpackColor(chunk.color(i), target + 24);
+            }
+        }
+        const size_t bytes = chunk.size() * record;
+        writeOk = writeOk && std::fwrite(buffer.data(), 1, bytes, out) == bytes;
+        rows += static_cast<int>(chunk.size());
+        chunk.clear();
+    };
+
+    bool readOk = PointLoader::forEachLine(input, header.dataOffset, [&](const char *begin, const char *end)
+    {
+        // Rows that do not parse are skipped, the same way the loader skips them
+        PointLoader::parseRow(begin, end, header.hasColor, chunk);
+        if (chunk.size() == kConvertChunk)
+        {
+            writeChunk();
+        }
+    });
+    writeChunk();
+
+    writeOk = std::fclose(out) == 0 && writeOk;
+    if (!readOk || !writeOk || rows != header.pointCount)
+    {
+        std::remove(output.c_str());
+        return false;
+    }
+    return true;
+}
+
+void BinaryPointFile::storeDouble(double value, unsigned char *out)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+}
+
+double BinaryPointFile::loadDouble(const unsigned char *in)
+{
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        bits |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -0,0 +1,79 @@
+#ifndef BINARY_POINT_FILE_H
+#define BINARY_POINT_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "Point.h"
+#include "PointLoader.h"
+
+/**
+ * @brief Memory-mapped view of a "DATA binary" point file.
+ *
+ * The data section follows the usual four header lines and holds packed
+ * little-endian records: x y z as 64-bit IEEE doubles, followed by r g b
+ * as one byte each when the FORMAT line is "x y z r g b". Points are read
+ * straight out of the mapping without any text parsing or staging buffer;
+ * loading a file still decodes every record once into the PointCloud's own
+ * arrays, since the file's interleaved records are not the cloud's layout.
+ */
+class BinaryPointFile
+{
+public:
+    BinaryPointFile() = default;
+    ~BinaryPointFile();
+    BinaryPointFile(const BinaryPointFile &) = delete;
+    BinaryPointFile &operator=(const BinaryPointFile &) = delete;
+
+    /**
+     * @brief Maps @p filename and checks that its data section matches the POINTS count.
+     */
+    bool open(const std::string &filename);
+    void close();
+
+    size_t size() const { return pointCount_; }
+    bool hasColor() const { return hasColor_; }
+    Point point(size_t index) const;
+    void color(size_t index, unsigned char rgb[3]) const;
+
+    /**
+     * @brief Size in bytes of one record of the data section.
+     */
+    static size_t recordSize(bool hasColor);
+
+    /**
+     * @brief Checks that a file of @p fileSize bytes holds exactly the records its header announces.
+     */
+    static bool hasExpectedSize(const PointFileHeader &header, size_t fileSize);
+
+    /**
+     * @brief Loads every point, and colour if present, of a binary file into @p cloud.
+     *
+     * The records are copied from the mapping into the cloud, which is
+     * reserved up front so that the copy is the only one made.
+     */
+    static bool loadPoints(const std::string &filename, PointCloud &cloud);
+
+    /**
+     * @brief Writes a "DATA binary" copy of the ascii point file @p input to @p output.
+     *
+     * Fails, and removes @p output, if a row cannot be parsed or the number
+     * of rows does not match the POINTS line.
+     */
+    static bool convertFromAscii(const std::string &input, const std::string &output);
+
+    static void storeDouble(double value, unsigned char *out);
+    static double loadDouble(const unsigned char *in);
+
+private:
+    // Rows converted per write
+    static const size_t kConvertChunk = 1 << 15;
+
+    const unsigned char *mapping_ = nullptr;
+    size_t mappingSize_ = 0;
+    const unsigned char *records_ = nullptr;
+    size_t pointCount_ = 0;
+    bool hasColor_ = false;
+};
+
+#endif // BINARY_POINT_FILE_H
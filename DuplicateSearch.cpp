@@ -0,0 +1,314 @@
+#include "DuplicateSearch.h"
+#include "Profiler.h"
+#include "SpatialOrder.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+bool DuplicateSearch::find(const PointCloud &cloud, double tolerance, Result &result, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    result = Result();
+    result.tolerance = tolerance;
+    if (n >= kNone)
+    {
+        return false;
+    }
+    result.match.assign(n, kNone);
+    result.identical.assign(n, 0);
+    if (n < 2)
+    {
+        return true;
+    }
+
+    // Compact clouds are read in place rather than decoded into a copy
+    const bool useGrid = tolerance > 0;
+    const double toleranceSquared = tolerance * tolerance;
+    PointCloud::Array<uint32_t> order(cloud.allocator<uint32_t>());
+    std::vector<uint32_t> runStarts;
+    std::vector<uint64_t> runKeys;
+    sortIntoCells(cloud, tolerance, order, runStarts, runKeys, pool);
+    const size_t runs = runKeys.size();
+
+    std::atomic<uint64_t> exactPairs(0), nearPairs(0), evaluations(0);
+    const size_t runChunks = (runs + kRunChunkSize - 1) / kRunChunkSize;
+    pool.parallelFor(runChunks, [&](size_t chunk)
+    {
+        uint64_t chunkExact = 0, chunkNear = 0, chunkEvaluations = 0;
+        std::vector<uint32_t> neighbours;
+        const size_t firstRun = chunk * kRunChunkSize;
+        const size_t lastRun = std::min(runs, firstRun + kRunChunkSize);
+
+        // The cells x-1..x+1 of each of the 9 neighbouring (y, z) rows have consecutive keys,
+        // and those keys grow with the run's own key, so one cursor per row sweeps the runs once
+        const uint64_t rowOffsets[9] = {0, kRowStep, kRowStep * 2, kLayerStep, kLayerStep + kRowStep,
+                                        kLayerStep + kRowStep * 2, kLayerStep * 2, kLayerStep * 2 + kRowStep,
+                                        kLayerStep * 2 + kRowStep * 2};
+        size_t cursors[9];
+        for (int row = 0; useGrid && row < 9; ++row)
+        {
+            const uint64_t lowest = runKeys[firstRun] - 1 - kRowStep - kLayerStep + rowOffsets[row];
+            cursors[row] = std::lower_bound(runKeys.begin(), runKeys.end(), lowest) - runKeys.begin();
+        }
+
+        for (size_t run = firstRun; run < lastRun; ++run)
+        {
+            neighbours.assign(1, static_cast<uint32_t>(run));
+            for (int row = 0; useGrid && row < 9; ++row)
+            {
+                const uint64_t lowest = runKeys[run] - 1 - kRowStep - kLayerStep + rowOffsets[row];
+                size_t &cursor = cursors[row];
+                while (cursor < runs && runKeys[cursor] < lowest)
+                {
+                    ++cursor;
+                }
+                for (size_t neighbour = cursor; neighbour < runs && runKeys[neighbour] <= lowest + 2; ++neighbour)
+                {
+                    if (neighbour != run)
+                    {
+                        neighbours.push_back(static_cast<uint32_t>(neighbour));
+                    }
+                }
+            }
+
+            // Each point only looks back at earlier rows, so every pair is counted once
+            for (size_t k = runStarts[run]; k < runStarts[run + 1]; ++k)
+            {
+                const uint32_t point = order[k];
+                const size_t source = cloud.sourceIndex(point);
+                const Point position = cloud[point];
+                uint32_t best = kNone;
+                bool identical = false;
+                for (uint32_t neighbour : neighbours)
+                {
+                    for (size_t m = runStarts[neighbour]; m < runStarts[neighbour + 1]; ++m)
+                    {
+                        const uint32_t other = order[m];
+                        const size_t otherSource = cloud.sourceIndex(other);
+                        if (otherSource >= source)
+                        {
+                            continue;
+                        }
+                        ++chunkEvaluations;
+                        const Point otherPosition = cloud[other];
+                        double dx = position.x - otherPosition.x;
+                        double dy = position.y - otherPosition.y;
+                        double dz = position.z - otherPosition.z;
+                        double distanceSquared = dx * dx + dy * dy + dz * dz;
+                        if (!(distanceSquared <= toleranceSquared))
+                        {
+                            continue;
+                        }
+                        if (distanceSquared == 0)
+                        {
+                            ++chunkExact;
+                            identical = true;
+                        }
+                        else
+                        {
+                            ++chunkNear;
+                        }
+                        if (best == kNone || otherSource < cloud.sourceIndex(best))
+                        {
+                            best = other;
+                        }
+                    }
+                }
+                result.match[point] = best;
+                result.identical[point] = identical;
+            }
+        }
+        exactPairs += chunkExact;
+        nearPairs += chunkNear;
+        evaluations += chunkEvaluations;
+    });
+
+    result.exactPairs = exactPairs;
+    result.nearPairs = nearPairs;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (result.identical[i])
+        {
+            ++result.exactPoints;
+        }
+        else if (result.match[i] != kNone)
+        {
+            ++result.nearPoints;
+        }
+    }
+    Profiler::count(Profiler::DistanceEvaluations, evaluations);
+    return true;
+}
+
+std::vector<size_t> DuplicateSearch::keptPoints(const PointCloud &cloud, const Result &result, ThreadPool &pool)
+{
+    // Identity is transitive, so with a tolerance of 0 the first row of every group is the one without a match
+    std::vector<size_t> kept;
+    kept.reserve(cloud.size() - result.duplicates());
+    if (result.tolerance == 0 || result.nearPoints == 0)
+    {
+        for (size_t i = 0; i < result.match.size(); ++i)
+        {
+            if (result.match[i] == kNone)
+            {
+                kept.push_back(i);
+            }
+        }
+        cloud.sortBySource(kept);
+        return kept;
+    }
+
+    // Otherwise a point is only dropped for a kept point within the tolerance, so rows are decided in file order
+    const size_t n = cloud.size();
+    const double toleranceSquared = result.tolerance * result.tolerance;
+    PointCloud::Array<uint32_t> order(cloud.allocator<uint32_t>());
+    std::vector<uint32_t> runStarts;
+    std::vector<uint64_t> runKeys;
+    sortIntoCells(cloud, result.tolerance, order, runStarts, runKeys, pool);
+    const size_t runs = runKeys.size();
+    std::vector<uint32_t> runOf(n);
+    for (size_t run = 0; run < runs; ++run)
+    {
+        for (size_t k = runStarts[run]; k < runStarts[run + 1]; ++k)
+        {
+            runOf[order[k]] = static_cast<uint32_t>(run);
+        }
+    }
+
+    std::vector<size_t> rows(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        rows[i] = i;
+    }
+    cloud.sortBySource(rows);
+    std::vector<char> isKept(n, 0);
+    for (size_t point : rows)
+    {
+        // Points with no earlier row within the tolerance are always kept
+        bool keep = true;
+        const uint64_t key = runKeys[runOf[point]];
+        const Point position = cloud[point];
+        for (int row = 0; keep && result.match[point] != kNone && row < 9; ++row)
+        {
+            const uint64_t lowest = key - 1 - kRowStep - kLayerStep + (row % 3) * kRowStep + (row / 3) * kLayerStep;
+            size_t neighbour = std::lower_bound(runKeys.begin(), runKeys.end(), lowest) - runKeys.begin();
+            for (; keep && neighbour < runs && runKeys[neighbour] <= lowest + 2; ++neighbour)
+            {
+                // Later rows are not kept yet, so only earlier kept rows can match
+                for (size_t k = runStarts[neighbour]; keep && k < runStarts[neighbour + 1]; ++k)
+                {
+                    const uint32_t other = order[k];
+                    if (!isKept[other])
+                    {
+                        continue;
+                    }
+                    const Point otherPosition = cloud[other];
+                    double dx = position.x - otherPosition.x;
+                    double dy = position.y - otherPosition.y;
+                    double dz = position.z - otherPosition.z;
+                    keep = !(dx * dx + dy * dy + dz * dz <= toleranceSquared);
+                }
+            }
+        }
+        isKept[point] = keep;
+        if (keep)
+        {
+            kept.push_back(point);
+        }
+    }
+    return kept;
+}
+
+std::vector<size_t> DuplicateSearch::firstDuplicates(const PointCloud &cloud, const Result &result, size_t limit)
+{
+    std::vector<size_t> duplicates;
+    for (size_t i = 0; i < result.match.size(); ++i)
+    {
+        if (result.match[i] != kNone)
+        {
+            duplicates.push_back(i);
+        }
+    }
+    cloud.sortBySource(duplicates);
+    duplicates.resize(std::min(duplicates.size(), limit));
+    return duplicates;
+}
+
+void DuplicateSearch::sortIntoCells(const PointCloud &cloud, double tolerance, PointCloud::Array<uint32_t> &order,
+                                    std::vector<uint32_t> &runStarts, std::vector<uint64_t> &runKeys, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    Point low, high;
+    cloud.bounds(0, n, low, high);
+    const bool useGrid = tolerance > 0;
+
+    // Cells as small as the tolerance, unless that needs more than 21 bits per axis; cell 0 stays empty
+    const double extent = std::max(std::max(high.x - low.x, high.y - low.y), high.z - low.z);
+    const double cellSize = std::max(tolerance, extent / double(kMaxCell - 2));
+    const double inverseCellSize = useGrid ? 1.0 / cellSize : 0;
+
+    const size_t chunks = (n + kChunkSize - 1) / kChunkSize;
+    PointCloud::Array<uint64_t> keys(n, 0, cloud.allocator<uint64_t>());
+    pool.parallelFor(chunks, [&](size_t chunk)
+    {
+        const size_t end = std::min(n, (chunk + 1) * kChunkSize);
+        double xs[kDecodeBlock], ys[kDecodeBlock], zs[kDecodeBlock];
+        for (size_t begin = chunk * kChunkSize; begin < end; begin += kDecodeBlock)
+        {
+            const size_t count = std::min(end - begin, kDecodeBlock);
+            cloud.decode(begin, begin + count, xs, ys, zs);
+            for (size_t i = 0; i < count; ++i)
+            {
+                keys[begin + i] = useGrid ? cellKey(cellOf(xs[i] - low.x, inverseCellSize), cellOf(ys[i] - low.y, inverseCellSize),
+                                                    cellOf(zs[i] - low.z, inverseCellSize))
+                                          : coordinateKey(xs[i], ys[i], zs[i]);
+            }
+        }
+    });
+
+    // Sorted by key every cell is a run of consecutive points
+    order = SpatialOrder::sortedOrder(keys, pool);
+    runStarts.clear();
+    runKeys.clear();
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (k == 0 || keys[order[k]] != keys[order[k - 1]])
+        {
+            runStarts.push_back(static_cast<uint32_t>(k));
+            runKeys.push_back(keys[order[k]]);
+        }
+    }
+    runStarts.push_back(static_cast<uint32_t>(n));
+}
+
+uint64_t DuplicateSearch::cellOf(double offset, double inverseCellSize)
+{
+    // Cells start at 1 so that every neighbour has a valid coordinate; NaN coordinates land in cell 1
+    double cell = std::floor(offset * inverseCellSize);
+    if (!(cell > 0))
+    {
+        return 1;
+    }
+    return static_cast<uint64_t>(std::min(cell + 1, double(kMaxCell - 1)));
+}
+
+uint64_t DuplicateSearch::cellKey(uint64_t cx, uint64_t cy, uint64_t cz)
+{
+    return cx | cy * kRowStep | cz * kLayerStep;
+}
+
+uint64_t DuplicateSearch::coordinateKey(double x, double y, double z)
+{
+    // Adding 0.0 maps -0.0 to 0.0, which compare equal but differ in their bits
+    const double values[3] = {x + 0.0, y + 0.0, z + 0.0};
+    uint64_t key = 0;
+    for (double value : values)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        key = (key ^ bits) * 0x9e3779b97f4a7c15ULL;
+        key ^= key >> 29;
+    }
+    return key >> 1; // 63 bits, like the grid keys
+}
@@ -0,0 +1,95 @@
+#ifndef DUPLICATE_SEARCH_H
+#define DUPLICATE_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Finds duplicated and near-coincident points, as left by overlapping scan passes.
+ *
+ * Points are keyed by their cell in a uniform grid whose cell size is the
+ * tolerance (larger only if the cloud spans more than 2^21 cells on an
+ * axis), and the keys are sorted with SpatialOrder's parallel radix sort,
+ * so every cell becomes one run of points. A point then only has to be
+ * compared with the points of the 27 cells around its own, which takes
+ * expected O(n) time. The neighbouring runs are found by sweeping the
+ * sorted keys rather than by hashing, runs are processed in parallel, and
+ * every point only writes its own result, so no locking is needed. With a
+ * tolerance of 0 the key is a hash of the exact coordinates instead and
+ * only points with the same key are compared. Compact clouds are read in
+ * their own storage, without a decoded copy.
+ *
+ * Every point is matched against the points read before it from the file,
+ * so a duplicate always refers back to the row that came first.
+ */
+class DuplicateSearch
+{
+public:
+    static constexpr uint32_t kNone = ~uint32_t(0);
+
+    struct Result
+    {
+        double tolerance = 0;
+        size_t exactPoints = 0;  // Points identical to an earlier row
+        size_t nearPoints = 0;   // Points within the tolerance of an earlier row but identical to none
+        uint64_t exactPairs = 0; // Pairs of identical points
+        uint64_t nearPairs = 0;  // Pairs of distinct points within the tolerance
+
+        // Per point, the earliest row within the tolerance as a cloud index, or kNone
+        std::vector<uint32_t> match;
+        std::vector<char> identical; // Per point, whether an earlier row is identical
+
+        size_t duplicates() const { return exactPoints + nearPoints; }
+    };
+
+    /**
+     * @brief Matches every point of @p cloud with the earlier rows within @p tolerance.
+     *
+     * @return false, leaving @p result empty, for clouds of 2^32 points or more.
+     */
+    static bool find(const PointCloud &cloud, double tolerance, Result &result, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief The points to keep when deduplicating, in file order.
+     *
+     * Rows are taken in file order and a row is kept unless it lies within
+     * the tolerance of a row kept before it, so no two kept points are that
+     * close, and a chain of near duplicates keeps every point that is
+     * farther than the tolerance from the kept ones. With a tolerance of 0
+     * this is the first row of every group of identical points.
+     */
+    static std::vector<size_t> keptPoints(const PointCloud &cloud, const Result &result, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Up to @p limit duplicated points in file order.
+     */
+    static std::vector<size_t> firstDuplicates(const PointCloud &cloud, const Result &result, size_t limit);
+
+private:
+    /**
+     * @brief Sorts the points by their grid cell, or by their exact coordinates for a tolerance of 0.
+     *
+     * Every cell becomes the run order[runStarts[r]] .. order[runStarts[r + 1] - 1] with key runKeys[r].
+     * The keys and the order are charged to the cloud's account.
+     */
+    static void sortIntoCells(const PointCloud &cloud, double tolerance, PointCloud::Array<uint32_t> &order,
+                              std::vector<uint32_t> &runStarts, std::vector<uint64_t> &runKeys, ThreadPool &pool);
+    static uint64_t cellOf(double offset, double inverseCellSize);
+    static uint64_t cellKey(uint64_t cx, uint64_t cy, uint64_t cz);
+    static uint64_t coordinateKey(double x, double y, double z);
+
+    // Cell coordinates take 21 bits each, x lowest
+    static constexpr uint64_t kMaxCell = uint64_t(1) << 21;
+    static constexpr uint64_t kRowStep = kMaxCell;
+    static constexpr uint64_t kLayerStep = kMaxCell * kMaxCell;
+
+    // Points per key chunk, points decoded at a time within it, and runs per query chunk
+    static constexpr size_t kChunkSize = size_t(1) << 16;
+    static constexpr size_t kDecodeBlock = 1024;
+    static constexpr size_t kRunChunkSize = size_t(1) << 12;
+};
+
+#endif // DUPLICATE_SEARCH_H
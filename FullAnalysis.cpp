@@ -0,0 +1,143 @@
+#include "FullAnalysis.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <limits>
+
+FullAnalysis::Result FullAnalysis::analyze(const std::string &filename, const KDTree &index, const Sphere *sphere,
+                                           double tolerance, ThreadPool &pool)
+{
+    const PointCloud &cloud = index.cloud();
+    Result result;
+    auto computeSummary = [&]()
+    {
+        // Chunk results are combined in chunk order, so the centroid does not depend on the thread count
+        const size_t n = cloud.size();
+        const size_t chunks = (n + kChunkSize - 1) / kChunkSize;
+        std::vector<Point> chunkLow(chunks), chunkHigh(chunks);
+        std::vector<double> chunkSum(3 * chunks);
+        pool.parallelFor(chunks, [&](size_t chunk)
+        {
+            summarize(cloud, chunk * kChunkSize, std::min(n, (chunk + 1) * kChunkSize),
+                      chunkLow[chunk], chunkHigh[chunk], &chunkSum[3 * chunk]);
+        });
+
+        result.low = Point{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+        result.high = Point{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+        double sum[3] = {0, 0, 0};
+        for (size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            result.low.x = std::min(result.low.x, chunkLow[chunk].x);
+            result.low.y = std::min(result.low.y, chunkLow[chunk].y);
+            result.low.z = std::min(result.low.z, chunkLow[chunk].z);
+            result.high.x = std::max(result.high.x, chunkHigh[chunk].x);
+            result.high.y = std::max(result.high.y, chunkHigh[chunk].y);
+            result.high.z = std::max(result.high.z, chunkHigh[chunk].z);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                sum[axis] += chunkSum[3 * chunk + axis];
+            }
+        }
+        if (n > 0)
+        {
+            result.centroid = Point{sum[0] / n, sum[1] / n, sum[2] / n};
+        }
+    };
+
+    // The stages only read the cloud, so they run concurrently; each is profiled on its own row
+    const size_t stages = sphere != nullptr ? 5 : 4;
+    pool.parallelFor(stages, [&](size_t stage)
+    {
+        switch (stage)
+        {
+        case 0:
+        {
+            Profiler::Scope scope(filename, "bounds_centroid");
+            computeSummary();
+            break;
+        }
+        case 1:
+        {
+            Profiler::Scope scope(filename, "closest_pair");
+            result.closest = PairSearch::inSourceOrder(cloud, PairSearch::closestPair(index, pool));
+            break;
+        }
+        case 2:
+        {
+            if (tolerance > 0)
+            {
+                Profiler::Scope scope(filename, "farthest_estimate");
+                ApproximateDistance::DiameterEstimate estimate = ApproximateDistance::diameter(cloud, tolerance, pool);
+                result.farthest = PairSearch::inSourceOrder(cloud, estimate.pair);
+                result.farthestUpperBound = estimate.upperBound;
+                break;
+            }
+            Profiler::Scope scope(filename, "farthest_pair");
+            result.farthest = PairSearch::inSourceOrder(cloud, PairSearch::farthestPair(index, pool));
+            break;
+        }
+        case 3:
+        {
+            // A tolerance of 0 makes the estimate the exact average
+            Profiler::Scope scope(filename, tolerance > 0 ? "average_estimate" : "average_distance");
+            result.average = ApproximateDistance::average(cloud, tolerance, pool);
+            break;
+        }
+        default:
+        {
+            Profiler::Scope scope(filename, "sphere_query");
+            index.sphereQuery(sphere->centre, sphere->radius, result.sphereHits);
+            cloud.sortBySource(result.sphereHits);
+            Profiler::count(Profiler::QueryHits, result.sphereHits.size());
+        }
+        }
+    });
+    return result;
+}
+
+void FullAnalysis::summarize(const PointCloud &cloud, size_t begin, size_t end, Point &low, Point &high, double sum[3])
+{
+    double lows[3], highs[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        lows[axis] = std::numeric_limits<double>::max();
+        highs[axis] = std::numeric_limits<double>::lowest();
+        sum[axis] = 0;
+    }
+
+    // Blocks of decoded coordinates; each axis is swept once for min, max and sum together
+    double block[3][kBlockSize];
+    for (size_t first = begin; first < end; first += kBlockSize)
+    {
+        const size_t count = std::min(kBlockSize, end - first);
+        const double *axes[3];
+        if (cloud.storage() == PointCloud::Storage::Double)
+        {
+            axes[0] = cloud.xData() + first;
+            axes[1] = cloud.yData() + first;
+            axes[2] = cloud.zData() + first;
+        }
+        else
+        {
+            cloud.decode(first, first + count, block[0], block[1], block[2]);
+            axes[0] = block[0];
+            axes[1] = block[1];
+            axes[2] = block[2];
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double *values = axes[axis];
+            double blockLow = lows[axis], blockHigh = highs[axis], blockSum = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                blockLow = std::min(blockLow, values[i]);
+                blockHigh = std::max(blockHigh, values[i]);
+                blockSum += values[i];
+            }
+            lows[axis] = blockLow;
+            highs[axis] = blockHigh;
+            sum[axis] += blockSum;
+        }
+    }
+    low = Point{lows[0], lows[1], lows[2]};
+    high = Point{highs[0], highs[1], highs[2]};
+}
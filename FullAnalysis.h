@@ -0,0 +1,62 @@
+#ifndef FULL_ANALYSIS_H
+#define FULL_ANALYSIS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "ApproximateDistance.h"
+#include "KDTree.h"
+#include "PairSearch.h"
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Every per-file analysis computed from one loaded cloud.
+ *
+ * The bounding box and the centroid come from a single fused sweep over the
+ * coordinates. That sweep, the closest and farthest pair searches, the
+ * average distance and the optional sphere query then run side by side on
+ * the pool, all reading the same cloud. The pair searches and the sphere
+ * query share the file's cached KD-tree, so no other search structure is
+ * built. With a tolerance the farthest pair and the average distance are
+ * estimated by ApproximateDistance instead.
+ */
+class FullAnalysis
+{
+public:
+    struct Sphere
+    {
+        Point centre;
+        double radius = 0;
+    };
+
+    struct Result
+    {
+        Point low, high;
+        Point centroid;
+        PointPair closest, farthest;
+        double farthestUpperBound = 0; // Bound on the diameter, only with a tolerance
+        ApproximateDistance::AverageEstimate average;
+        std::vector<size_t> sphereHits; // In file order
+    };
+
+    /**
+     * @brief Analyzes the cloud of @p index, also querying @p sphere when it is not null.
+     *
+     * @param filename Names the profiler rows of the stages.
+     * @param tolerance Relative tolerance of the farthest pair and average distance, 0 for exact.
+     */
+    static Result analyze(const std::string &filename, const KDTree &index, const Sphere *sphere = nullptr,
+                          double tolerance = 0, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Bounding box and coordinate sums of the points [begin, end) in one pass.
+     */
+    static void summarize(const PointCloud &cloud, size_t begin, size_t end, Point &low, Point &high, double sum[3]);
+
+private:
+    static constexpr size_t kChunkSize = size_t(1) << 20;
+    static constexpr size_t kBlockSize = 1024;
+};
+
+#endif // FULL_ANALYSIS_H
@@ -0,0 +1,361 @@
+#include "KDTree.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <queue>
+
+KDTree::KDTree(std::shared_ptr<const PointCloud> cloud)
+    : cloud_(std::move(cloud)), nodes_(cloud_->allocator<Node>()), order_(cloud_->allocator<size_t>()),
+      xs_(cloud_->allocator<double>()), ys_(cloud_->allocator<double>()), zs_(cloud_->allocator<double>())
+{
+    const size_t n = cloud_->size();
+    order_.resize(n);
+    std::iota(order_.begin(), order_.end(), size_t(0));
+    if (n > 0)
+    {
+        nodes_.reserve(2 * (n / kLeafSize + 1));
+        build(0, n);
+    }
+
+    // Double clouds get their coordinates copied in leaf order; compact clouds
+    // are read in their own storage, so the tree adds no copy of them
+    if (cloud_->storage() == PointCloud::Storage::Double)
+    {
+        PointCloud::Array<double> *axes[3] = {&xs_, &ys_, &zs_};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            axes[axis]->resize(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                (*axes[axis])[i] = cloud_->coordinate(axis, order_[i]);
+            }
+        }
+    }
+}
+
+size_t KDTree::build(size_t begin, size_t end)
+{
+    // Double clouds are read through their arrays, compact ones decoded point by point
+    const PointCloud &cloud = *cloud_;
+    const double *axes[3] = {cloud.xData(), cloud.yData(), cloud.zData()};
+    const bool inPlace = cloud.storage() == PointCloud::Storage::Double;
+    auto value = [&cloud, &axes, inPlace](int axis, size_t point)
+    {
+        return inPlace ? axes[axis][point] : cloud.coordinate(axis, point);
+    };
+
+    Node node;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        node.low[axis] = std::numeric_limits<double>::max();
+        node.high[axis] = std::numeric_limits<double>::lowest();
+        for (size_t i = begin; i < end; ++i)
+        {
+            double coordinate = value(axis, order_[i]);
+            node.low[axis] = std::min(node.low[axis], coordinate);
+            node.high[axis] = std::max(node.high[axis], coordinate);
+        }
+    }
+    node.begin = begin;
+    node.end = end;
+    node.left = kLeaf;
+    node.right = kLeaf;
+
+    size_t id = nodes_.size();
+    nodes_.push_back(node);
+    if (end - begin <= kLeafSize)
+    {
+        return id;
+    }
+
+    // Split the widest axis at the median
+    int axis = 0;
+    for (int candidate = 1; candidate < 3; ++candidate)
+    {
+        if (node.high[candidate] - node.low[candidate] > node.high[axis] - node.low[axis])
+        {
+            axis = candidate;
+        }
+    }
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order_.begin() + begin, order_.begin() + middle, order_.begin() + end,
+                     [&value, axis](size_t a, size_t b) { return value(axis, a) < value(axis, b); });
+
+    size_t left = build(begin, middle);
+    size_t right = build(middle, end);
+    nodes_[id].left = left;
+    nodes_[id].right = right;
+    return id;
+}
+
+void KDTree::sphereQuery(const Point &centre, double radius, std::vector<size_t> &out) const
+{
+    if (nodes_.empty() || radius < 0)
+    {
+        return;
+    }
+    const double query[3] = {centre.x, centre.y, centre.z};
+    const double radiusSquared = radius * radius;
+
+    std::vector<size_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node &node = nodes_[stack.back()];
+        stack.pop_back();
+        if (boxDistanceSquared(node, query) > radiusSquared)
+        {
+            continue;
+        }
+
+        // Take the whole subtree when its farthest corner is inside the sphere
+        if (boxFarthestSquared(node, query) <= radiusSquared)
+        {
+            appendRange(node.begin, node.end, out);
+            continue;
+        }
+
+        if (node.left == kLeaf)
+        {
+            for (size_t i = node.begin; i < node.end; ++i)
+            {
+                const Point point = leafPoint(i);
+                double dx = point.x - query[0];
+                double dy = point.y - query[1];
+                double dz = point.z - query[2];
+                if (dx * dx + dy * dy + dz * dz <= radiusSquared)
+                {
+                    out.push_back(order_[i]);
+                }
+            }
+            continue;
+        }
+        stack.push_back(node.left);
+        stack.push_back(node.right);
+    }
+}
+
+void KDTree::boxQuery(const Point &low, const Point &high, std::vector<size_t> &out) const
+{
+    if (nodes_.empty())
+    {
+        return;
+    }
+    const double boxLow[3] = {low.x, low.y, low.z};
+    const double boxHigh[3] = {high.x, high.y, high.z};
+
+    std::vector<size_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node &node = nodes_[stack.back()];
+        stack.pop_back();
+
+        bool disjoint = false, contained = true;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            disjoint = disjoint || node.high[axis] < boxLow[axis] || node.low[axis] > boxHigh[axis];
+            contained = contained && node.low[axis] >= boxLow[axis] && node.high[axis] <= boxHigh[axis];
+        }
+        if (disjoint)
+        {
+            continue;
+        }
+        if (contained)
+        {
+            appendRange(node.begin, node.end, out);
+            continue;
+        }
+
+        if (node.left == kLeaf)
+        {
+            for (size_t i = node.begin; i < node.end; ++i)
+            {
+                const Point point = leafPoint(i);
+                if (point.x >= boxLow[0] && point.x <= boxHigh[0] &&
+                    point.y >= boxLow[1] && point.y <= boxHigh[1] &&
+                    point.z >= boxLow[2] && point.z <= boxHigh[2])
+                {
+                    out.push_back(order_[i]);
+                }
+            }
+            continue;
+        }
+        stack.push_back(node.left);
+        stack.push_back(node.right);
+    }
+}
+
+std::vector<std::pair<double, size_t>> KDTree::nearest(const Point &query, size_t k) const
+{
+    std::vector<std::pair<double, size_t>> best; // Max-heap on squared distance
+    if (nodes_.empty() || k == 0)
+    {
+        return best;
+    }
+    const double target[3] = {query.x, query.y, query.z};
+
+    // Visit nodes nearest-box-first and stop once no box can improve the k-th distance
+    typedef std::pair<double, size_t> Candidate;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+    frontier.push(Candidate(boxDistanceSquared(nodes_[0], target), 0));
+    while (!frontier.empty())
+    {
+        Candidate candidate = frontier.top();
+        frontier.pop();
+        if (best.size() == k && candidate.first > best.front().first)
+        {
+            break;
+        }
+
+        const Node &node = nodes_[candidate.second];
+        if (node.left == kLeaf)
+        {
+            for (size_t i = node.begin; i < node.end; ++i)
+            {
+                const Point point = leafPoint(i);
+                double dx = point.x - target[0];
+                double dy = point.y - target[1];
+                double dz = point.z - target[2];
+                std::pair<double, size_t> hit(dx * dx + dy * dy + dz * dz, order_[i]);
+                if (best.size() < k)
+                {
+                    best.push_back(hit);
+                    std::push_heap(best.begin(), best.end());
+                }
+                else if (hit < best.front())
+                {
+                    std::pop_heap(best.begin(), best.end());
+                    best.back() = hit;
+                    std::push_heap(best.begin(), best.end());
+                }
+            }
+            continue;
+        }
+        frontier.push(Candidate(boxDistanceSquared(nodes_[node.left], target), node.left));
+        frontier.push(Candidate(boxDistanceSquared(nodes_[node.right], target), node.right));
+    }
+
+    std::sort_heap(best.begin(), best.end());
+    return best;
+}
+
+double KDTree::nearestOtherSquared(size_t index, double bound) const
+{
+    if (nodes_.empty())
+    {
+        return bound;
+    }
+    const Point point = (*cloud_)[index];
+    const double target[3] = {point.x, point.y, point.z};
+
+    // Depth first, nearer child first; the depth is below 64 for any cloud of 2^32 points
+    size_t stack[2 * 64];
+    size_t depth = 0;
+    stack[depth++] = 0;
+    double best = bound;
+    while (depth > 0)
+    {
+        const Node &node = nodes_[stack[--depth]];
+        if (boxDistanceSquared(node, target) > best)
+        {
+            continue;
+        }
+        if (node.left == kLeaf)
+        {
+            for (size_t i = node.begin; i < node.end; ++i)
+            {
+                const Point other = leafPoint(i);
+                double dx = other.x - target[0];
+                double dy = other.y - target[1];
+                double dz = other.z - target[2];
+                double distanceSquared = dx * dx + dy * dy + dz * dz;
+                if (distanceSquared < best && order_[i] != index)
+                {
+                    best = distanceSquared;
+                }
+            }
+            continue;
+        }
+        const bool leftFirst = boxDistanceSquared(nodes_[node.left], target) <= boxDistanceSquared(nodes_[node.right], target);
+        stack[depth++] = leftFirst ? node.right : node.left;
+        stack[depth++] = leftFirst ? node.left : node.right;
+    }
+    return best;
+}
+
+std::pair<double, size_t> KDTree::farthest(const Point &query) const
+{
+    std::pair<double, size_t> best(-1.0, order_.size());
+    if (nodes_.empty())
+    {
+        return best;
+    }
+    const double target[3] = {query.x, query.y, query.z};
+
+    // Visit nodes farthest-corner-first and skip those whose farthest corner is nearer than the best
+    typedef std::pair<double, size_t> Candidate;
+    std::priority_queue<Candidate> frontier;
+    frontier.push(Candidate(boxFarthestSquared(nodes_[0], target), 0));
+    while (!frontier.empty())
+    {
+        Candidate candidate = frontier.top();
+        frontier.pop();
+        if (candidate.first < best.first)
+        {
+            break;
+        }
+
+        const Node &node = nodes_[candidate.second];
+        if (node.left == kLeaf)
+        {
+            for (size_t i = node.begin; i < node.end; ++i)
+            {
+                const Point point = leafPoint(i);
+                double dx = point.x - target[0];
+                double dy = point.y - target[1];
+                double dz = point.z - target[2];
+                double distanceSquared = dx * dx + dy * dy + dz * dz;
+                if (distanceSquared > best.first || (distanceSquared == best.first && order_[i] < best.second))
+                {
+                    best = std::pair<double, size_t>(distanceSquared, order_[i]);
+                }
+            }
+            continue;
+        }
+        frontier.push(Candidate(boxFarthestSquared(nodes_[node.left], target), node.left));
+        frontier.push(Candidate(boxFarthestSquared(nodes_[node.right], target), node.right));
+    }
+    return best;
+}
+
+size_t KDTree::memoryBytes() const
+{
+    return nodes_.capacity() * sizeof(Node) + order_.capacity() * sizeof(size_t) +
+           (xs_.capacity() + ys_.capacity() + zs_.capacity()) * sizeof(double);
+}
+
+void KDTree::appendRange(size_t begin, size_t end, std::vector<size_t> &out) const
+{
+    out.insert(out.end(), order_.begin() + begin, order_.begin() + end);
+}
+
+double KDTree::boxDistanceSquared(const Node &node, const double query[3]) const
+{
+    double distanceSquared = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double gap = std::max(std::max(node.low[axis] - query[axis], query[axis] - node.high[axis]), 0.0);
+        distanceSquared += gap * gap;
+    }
+    return distanceSquared;
+}
+
+double KDTree::boxFarthestSquared(const Node &node, const double query[3]) const
+{
+    double distanceSquared = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double reach = std::max(query[axis] - node.low[axis], node.high[axis] - query[axis]);
+        distanceSquared += reach * reach;
+    }
+    return distanceSquared;
+}
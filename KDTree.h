@@ -0,0 +1,90 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "PointCloud.h"
+
+/**
+ * @brief Static KD-tree over one point cloud for region and neighbour queries.
+ *
+ * The tree is built once by splitting the widest axis at the median until
+ * a node holds at most kLeafSize points. The coordinates of Storage::Double
+ * clouds are copied into tree order so a leaf is a contiguous run of
+ * memory; compact clouds are read in their own storage instead, so that
+ * indexing them does not undo the memory they save. Every node keeps its
+ * bounding box, which lets a query skip a subtree that cannot contain a hit
+ * and take a subtree whole when it lies entirely inside the query region.
+ *
+ * Queries return indices into the original cloud in no particular order
+ * and compare squared distances throughout.
+ */
+class KDTree
+{
+public:
+    explicit KDTree(std::shared_ptr<const PointCloud> cloud);
+
+    /**
+     * @brief Appends the indices of all points within @p radius of @p centre (inclusive).
+     */
+    void sphereQuery(const Point &centre, double radius, std::vector<size_t> &out) const;
+
+    /**
+     * @brief Appends the indices of all points inside the inclusive box [@p low, @p high].
+     */
+    void boxQuery(const Point &low, const Point &high, std::vector<size_t> &out) const;
+
+    /**
+     * @brief The @p k nearest points to @p query as (squared distance, index), nearest first.
+     */
+    std::vector<std::pair<double, size_t>> nearest(const Point &query, size_t k) const;
+
+    /**
+     * @brief Squared distance from point @p index of the cloud to its nearest other point.
+     *
+     * Subtrees farther than @p bound are skipped, and @p bound is returned
+     * if no other point is nearer, so passing the best distance found so far
+     * makes repeated searches cheap. A duplicate of the point is at distance 0.
+     */
+    double nearestOtherSquared(size_t index, double bound) const;
+
+    /**
+     * @brief The point farthest from @p query as (squared distance, index); ties go to the smaller index.
+     *
+     * Returns index size() for an empty tree.
+     */
+    std::pair<double, size_t> farthest(const Point &query) const;
+
+    const PointCloud &cloud() const { return *cloud_; }
+    const std::shared_ptr<const PointCloud> &sharedCloud() const { return cloud_; }
+    size_t memoryBytes() const;
+
+private:
+    struct Node
+    {
+        double low[3], high[3]; // Bounding box of the points below this node
+        size_t begin, end;      // Range in tree order
+        size_t left, right;     // Child nodes, kLeaf for a leaf
+    };
+
+    static constexpr size_t kLeafSize = 16;
+    static constexpr size_t kLeaf = ~size_t(0);
+
+    size_t build(size_t begin, size_t end);
+    Point leafPoint(size_t position) const
+    {
+        return xs_.empty() ? (*cloud_)[order_[position]] : Point{xs_[position], ys_[position], zs_[position]};
+    }
+    void appendRange(size_t begin, size_t end, std::vector<size_t> &out) const;
+    double boxDistanceSquared(const Node &node, const double query[3]) const;
+    double boxFarthestSquared(const Node &node, const double query[3]) const;
+
+    std::shared_ptr<const PointCloud> cloud_;
+    // Charged to the cloud's memory account
+    PointCloud::Array<Node> nodes_;
+    PointCloud::Array<size_t> order_;        // Tree position -> index in the cloud
+    PointCloud::Array<double> xs_, ys_, zs_; // Coordinates in tree order, empty for compact clouds
+};
+
+#endif // KD_TREE_H
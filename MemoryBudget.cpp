@@ -0,0 +1,53 @@
+#include "MemoryBudget.h"
+
+void MemoryBudget::Account::charge(size_t bytes)
+{
+    if (budgeted_)
+    {
+        MemoryBudget::charge(bytes);
+    }
+    MemoryBudget::raise(peak_, current_.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void MemoryBudget::Account::release(size_t bytes)
+{
+    current_.fetch_sub(bytes, std::memory_order_relaxed);
+    if (budgeted_)
+    {
+        MemoryBudget::release(bytes);
+    }
+}
+
+bool MemoryBudget::fits(size_t bytes)
+{
+    size_t limit = MemoryBudget::limit();
+    return limit == 0 || used() + bytes <= limit;
+}
+
+void MemoryBudget::charge(size_t bytes)
+{
+    // Reserve the bytes before anything is allocated, so concurrent loads cannot overshoot together
+    size_t now = used_.load(std::memory_order_relaxed);
+    do
+    {
+        size_t limit = MemoryBudget::limit();
+        if (limit != 0 && now + bytes > limit)
+        {
+            throw BudgetExceeded();
+        }
+    } while (!used_.compare_exchange_weak(now, now + bytes, std::memory_order_relaxed));
+    raise(peak_, now + bytes);
+}
+
+void MemoryBudget::release(size_t bytes)
+{
+    used_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryBudget::raise(std::atomic<size_t> &peak, size_t value)
+{
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief Thrown when an allocation would take the process over its memory budget.
+ */
+class BudgetExceeded : public std::bad_alloc
+{
+public:
+    const char *what() const noexcept override { return "memory budget exceeded"; }
+};
+
+/**
+ * @brief Process-wide limit on the bytes held by point and index storage.
+ *
+ * Storage allocated through BudgetAllocator is charged here, and also to
+ * the Account of the file it belongs to, which remembers that file's peak.
+ * Once a limit is set, an allocation that would exceed it throws
+ * BudgetExceeded before any memory is taken, so callers can refuse the
+ * file or fall back to streaming instead of running out of memory.
+ */
+class MemoryBudget
+{
+public:
+    /**
+     * @brief Bytes charged on behalf of one file, and their peak.
+     *
+     * An account created with @p budgeted false only counts its bytes, for
+     * small fixed-size scratch storage that must stay available when the
+     * budget is exhausted, such as the chunks of the streaming fallback.
+     */
+    class Account
+    {
+    public:
+        explicit Account(bool budgeted = true) : budgeted_(budgeted) {}
+
+        void charge(size_t bytes);
+        void release(size_t bytes);
+        size_t current() const { return current_.load(std::memory_order_relaxed); }
+        size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+    private:
+        const bool budgeted_;
+        std::atomic<size_t> current_{0};
+        std::atomic<size_t> peak_{0};
+    };
+
+    /**
+     * @brief Sets the limit in bytes, 0 for none (the default).
+     */
+    static void setLimit(size_t bytes) { limit_.store(bytes, std::memory_order_relaxed); }
+    static size_t limit() { return limit_.load(std::memory_order_relaxed); }
+    static size_t used() { return used_.load(std::memory_order_relaxed); }
+    static size_t peak() { return peak_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Whether @p bytes more would fit right now.
+     */
+    static bool fits(size_t bytes);
+
+    /**
+     * @brief Takes @p bytes from the budget, throwing BudgetExceeded if they do not fit.
+     */
+    static void charge(size_t bytes);
+    static void release(size_t bytes);
+
+private:
+    static void raise(std::atomic<size_t> &peak, size_t value);
+
+    static inline std::atomic<size_t> limit_{0};
+    static inline std::atomic<size_t> used_{0};
+    static inline std::atomic<size_t> peak_{0};
+};
+
+/**
+ * @brief std::allocator that charges its allocations to the MemoryBudget and an optional Account.
+ *
+ * Copies share the account, which lives as long as any container using it.
+ */
+template <typename T>
+class BudgetAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    BudgetAllocator(std::shared_ptr<MemoryBudget::Account> account = nullptr) noexcept : account_(std::move(account)) {}
+    template <typename U>
+    BudgetAllocator(const BudgetAllocator<U> &other) noexcept : account_(other.account()) {}
+
+    T *allocate(size_t count)
+    {
+        const size_t bytes = count * sizeof(T);
+        if (account_ != nullptr)
+        {
+            account_->charge(bytes);
+        }
+        else
+        {
+            MemoryBudget::charge(bytes);
+        }
+        try
+        {
+            return std::allocator<T>().allocate(count);
+        }
+        catch (...)
+        {
+            release(bytes);
+            throw;
+        }
+    }
+
+    void deallocate(T *pointer, size_t count) noexcept
+    {
+        std::allocator<T>().deallocate(pointer, count);
+        release(count * sizeof(T));
+    }
+
+    const std::shared_ptr<MemoryBudget::Account> &account() const { return account_; }
+
+    template <typename U>
+    bool operator==(const BudgetAllocator<U> &other) const { return account_ == other.account(); }
+    template <typename U>
+    bool operator!=(const BudgetAllocator<U> &other) const { return account_ != other.account(); }
+
+private:
+    void release(size_t bytes) noexcept
+    {
+        if (account_ != nullptr)
+        {
+            account_->release(bytes);
+        }
+        else
+        {
+            MemoryBudget::release(bytes);
+        }
+    }
+
+    std::shared_ptr<MemoryBudget::Account> account_;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,522 @@
+#include "PairSearch.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    // Below this size the double loop is faster than building any structure
+    const size_t kBruteForceLimit = 64;
+    const size_t kNoPoint = std::numeric_limits<size_t>::max();
+
+    // Points per nearest neighbour chunk, and points per batch of farthest point queries
+    const size_t kTreeChunkSize = 4096;
+    const size_t kTreeBatchSize = 64;
+    const uint64_t kEmptyCell = ~uint64_t(0); // Never produced by packCell, which uses 63 bits
+
+    // Grid cells are packed as three 21-bit coordinates. Cells that wrap
+    // around share a key, which only adds candidates and never hides one.
+    uint64_t packCell(int64_t cx, int64_t cy, int64_t cz)
+    {
+        const uint64_t mask = (uint64_t(1) << 21) - 1;
+        return (uint64_t(cx) & mask) | ((uint64_t(cy) & mask) << 21) | ((uint64_t(cz) & mask) << 42);
+    }
+
+    // Open-addressing map from cell key to the first point of that cell.
+    // The node-based std::unordered_map spends most of its time chasing pointers here.
+    class CellTable
+    {
+    public:
+        explicit CellTable(size_t points)
+        {
+            size_t capacity = 16;
+            while (capacity < points * 2)
+            {
+                capacity *= 2;
+            }
+            keys_.assign(capacity, kEmptyCell);
+            heads_.assign(capacity, kNoPoint);
+            mask_ = capacity - 1;
+        }
+
+        void clear()
+        {
+            std::fill(keys_.begin(), keys_.end(), kEmptyCell);
+        }
+
+        // Returns the head slot of the cell, or nullptr when no point is in it
+        size_t *find(uint64_t key)
+        {
+            for (size_t slot = hash(key);; slot = (slot + 1) & mask_)
+            {
+                if (keys_[slot] == key)
+                {
+                    return &heads_[slot];
+                }
+                if (keys_[slot] == kEmptyCell)
+                {
+                    return nullptr;
+                }
+            }
+        }
+
+        // Returns the head slot of the cell, creating it with kNoPoint if needed
+        size_t &findOrInsert(uint64_t key)
+        {
+            size_t slot = hash(key);
+            while (keys_[slot] != key && keys_[slot] != kEmptyCell)
+            {
+                slot = (slot + 1) & mask_;
+            }
+            if (keys_[slot] == kEmptyCell)
+            {
+                keys_[slot] = key;
+                heads_[slot] = kNoPoint;
+            }
+            return heads_[slot];
+        }
+
+    private:
+        size_t hash(uint64_t key) const
+        {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return static_cast<size_t>(key) & mask_;
+        }
+
+        std::vector<uint64_t> keys_;
+        std::vector<size_t> heads_;
+        size_t mask_;
+    };
+
+    int64_t cellCoordinate(double offset, double inverseCellSize)
+    {
+        // Clamping keeps the conversion defined for huge ratios; it is monotone,
+        // so points closer than one cell still land in neighbouring cells
+        double cell = std::floor(offset * inverseCellSize);
+        return static_cast<int64_t>(std::min(std::max(cell, 0.0), 4.0e18));
+    }
+}
+
+PointPair PairSearch::closestPair(const PointCloud &cloud)
+{
+    const size_t n = cloud.size();
+    if (n <= kBruteForceLimit)
+    {
+        return closestPairBruteForce(cloud);
+    }
+
+    const DecodedCoordinates coordinates(cloud);
+    const double *xs = coordinates.x();
+    const double *ys = coordinates.y();
+    const double *zs = coordinates.z();
+    double minX = *std::min_element(xs, xs + n);
+    double minY = *std::min_element(ys, ys + n);
+    double minZ = *std::min_element(zs, zs + n);
+
+    // A fixed seed keeps the result reproducible; the order only affects speed
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(0x5eed));
+
+    PointPair best;
+    offerClosest(best, order[0], order[1], distanceSquared(coordinates, order[0], order[1]));
+    uint64_t evaluations = 1;
+    if (best.distanceSquared == 0)
+    {
+        Profiler::count(Profiler::DistanceEvaluations, evaluations);
+        return closestDuplicatePair(cloud);
+    }
+
+    CellTable cellHeads(n); // First point of each cell, chained through next
+    std::vector<size_t> next(n, kNoPoint);
+    double inverseCellSize = 0;
+
+    auto keyOf = [&](size_t index, int64_t offsetX, int64_t offsetY, int64_t offsetZ)
+    {
+        return packCell(cellCoordinate(xs[index] - minX, inverseCellSize) + offsetX,
+                        cellCoordinate(ys[index] - minY, inverseCellSize) + offsetY,
+                        cellCoordinate(zs[index] - minZ, inverseCellSize) + offsetZ);
+    };
+    auto insert = [&](size_t index)
+    {
+        size_t &head = cellHeads.findOrInsert(keyOf(index, 0, 0, 0));
+        next[index] = head;
+        head = index;
+    };
+    auto rebuild = [&](size_t count)
+    {
+        cellHeads.clear();
+        inverseCellSize = 1.0 / std::sqrt(best.distanceSquared);
+        for (size_t k = 0; k < count; ++k)
+        {
+            insert(order[k]);
+        }
+    };
+
+    rebuild(2);
+    for (size_t k = 2; k < n; ++k)
+    {
+        const size_t index = order[k];
+        const double previousBest = best.distanceSquared;
+        for (int64_t dx = -1; dx <= 1; ++dx)
+        {
+            for (int64_t dy = -1; dy <= 1; ++dy)
+            {
+                for (int64_t dz = -1; dz <= 1; ++dz)
+                {
+                    size_t *head = cellHeads.find(keyOf(index, dx, dy, dz));
+                    if (head == nullptr)
+                    {
+                        continue;
+                    }
+                    for (size_t other = *head; other != kNoPoint; other = next[other])
+                    {
+                        ++evaluations;
+                        double candidate = distanceSquared(coordinates, index, other);
+                        if (candidate <= best.distanceSquared)
+                        {
+                            offerClosest(best, index, other, candidate);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (best.distanceSquared == 0)
+        {
+            Profiler::count(Profiler::DistanceEvaluations, evaluations);
+            return closestDuplicatePair(cloud);
+        }
+        if (best.distanceSquared < previousBest)
+        {
+            rebuild(k + 1);
+        }
+        else
+        {
+            insert(index);
+        }
+    }
+    Profiler::count(Profiler::DistanceEvaluations, evaluations);
+    return best;
+}
+
+PointPair PairSearch::farthestPair(const PointCloud &cloud)
+{
+    const size_t n = cloud.size();
+    if (n <= kBruteForceLimit)
+    {
+        return farthestPairBruteForce(cloud);
+    }
+
+    const DecodedCoordinates coordinates(cloud);
+    const double *xs = coordinates.x();
+    const double *ys = coordinates.y();
+    const double *zs = coordinates.z();
+
+    // Seed the bound with every pair of extreme points along 13 directions
+    static const double directions[13][3] = {
+        {1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+        {1, 1, 0}, {1, -1, 0}, {1, 0, 1}, {1, 0, -1}, {0, 1, 1}, {0, 1, -1},
+        {1, 1, 1}, {1, 1, -1}, {1, -1, 1}, {-1, 1, 1}};
+    std::vector<size_t> extremes;
+    for (const auto &direction : directions)
+    {
+        size_t lowest = 0, highest = 0;
+        double lowestValue = std::numeric_limits<double>::max();
+        double highestValue = std::numeric_limits<double>::lowest();
+        for (size_t i = 0; i < n; ++i)
+        {
+            double projection = xs[i] * direction[0] + ys[i] * direction[1] + zs[i] * direction[2];
+            if (projection < lowestValue)
+            {
+                lowestValue = projection;
+                lowest = i;
+            }
+            if (projection > highestValue)
+            {
+                highestValue = projection;
+                highest = i;
+            }
+        }
+        extremes.push_back(lowest);
+        extremes.push_back(highest);
+    }
+
+    PointPair best;
+    uint64_t evaluations = 0;
+    for (size_t a = 0; a < extremes.size(); ++a)
+    {
+        for (size_t b = a + 1; b < extremes.size(); ++b)
+        {
+            if (extremes[a] != extremes[b])
+            {
+                ++evaluations;
+                offerFarthest(best, extremes[a], extremes[b], distanceSquared(coordinates, extremes[a], extremes[b]));
+            }
+        }
+    }
+
+    // Radii from the bounding box centre, visited from the outside in
+    Point centre{(*std::min_element(xs, xs + n) + *std::max_element(xs, xs + n)) / 2,
+                 (*std::min_element(ys, ys + n) + *std::max_element(ys, ys + n)) / 2,
+                 (*std::min_element(zs, zs + n) + *std::max_element(zs, zs + n)) / 2};
+    std::vector<double> radius(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        radius[i] = cloud[i].distanceTo(centre);
+    }
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return radius[a] > radius[b]; });
+
+    // The slack keeps rounding in r_a + r_b from pruning a pair that ties the bound
+    const double slack = 1.0 + 1e-9;
+    double bestDistance = best.distance();
+    for (size_t a = 0; a + 1 < n; ++a)
+    {
+        const double radiusA = radius[order[a]];
+        if ((radiusA + radius[order[a + 1]]) * slack < bestDistance)
+        {
+            break;
+        }
+        for (size_t b = a + 1; b < n; ++b)
+        {
+            if ((radiusA + radius[order[b]]) * slack < bestDistance)
+            {
+                break;
+            }
+            ++evaluations;
+            double candidate = distanceSquared(coordinates, order[a], order[b]);
+            if (candidate >= best.distanceSquared)
+            {
+                offerFarthest(best, order[a], order[b], candidate);
+                bestDistance = best.distance();
+            }
+        }
+    }
+    Profiler::count(Profiler::DistanceEvaluations, evaluations);
+    return best;
+}
+
+PointPair PairSearch::closestPair(const KDTree &index, ThreadPool &pool)
+{
+    const PointCloud &cloud = index.cloud();
+    const size_t n = cloud.size();
+    if (n <= kBruteForceLimit)
+    {
+        return closestPairBruteForce(cloud);
+    }
+
+    // Each chunk keeps the first of its points with the smallest distance to another point;
+    // searching below the chunk's best so far skips most of the tree
+    const size_t chunks = (n + kTreeChunkSize - 1) / kTreeChunkSize;
+    std::vector<std::pair<double, size_t>> chunkBest(chunks);
+    pool.parallelFor(chunks, [&](size_t chunk)
+    {
+        std::pair<double, size_t> best(std::numeric_limits<double>::infinity(), kNoPoint);
+        const size_t end = std::min(n, (chunk + 1) * kTreeChunkSize);
+        for (size_t i = chunk * kTreeChunkSize; i < end; ++i)
+        {
+            const double distanceSquared = index.nearestOtherSquared(i, best.first);
+            if (distanceSquared < best.first)
+            {
+                best = std::pair<double, size_t>(distanceSquared, i);
+            }
+        }
+        chunkBest[chunk] = best;
+    });
+    const std::pair<double, size_t> nearest = *std::min_element(chunkBest.begin(), chunkBest.end());
+
+    // Pair the first such point with its smallest neighbour at that distance, asking for more
+    // neighbours while the last one returned still ties
+    PointPair best;
+    for (size_t k = 2;; k *= 2)
+    {
+        const std::vector<std::pair<double, size_t>> neighbours = index.nearest(cloud[nearest.second], k);
+        for (const std::pair<double, size_t> &neighbour : neighbours)
+        {
+            if (neighbour.second != nearest.second && neighbour.first == nearest.first)
+            {
+                offerClosest(best, nearest.second, neighbour.second, neighbour.first);
+            }
+        }
+        if (neighbours.size() < k || neighbours.back().first > nearest.first)
+        {
+            break;
+        }
+    }
+    return best;
+}
+
+PointPair PairSearch::farthestPair(const KDTree &index, ThreadPool &pool)
+{
+    const PointCloud &cloud = index.cloud();
+    const size_t n = cloud.size();
+    if (n <= kBruteForceLimit)
+    {
+        return farthestPairBruteForce(cloud);
+    }
+
+    // Radii from the bounding box centre, visited from the outside in
+    Point low, high;
+    cloud.bounds(0, n, low, high);
+    const Point centre{(low.x + high.x) / 2, (low.y + high.y) / 2, (low.z + high.z) / 2};
+    std::vector<double> radius(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        radius[i] = cloud[i].distanceTo(centre);
+    }
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return radius[a] > radius[b]; });
+
+    // A pair through a point is at most its radius plus the largest one; the slack
+    // keeps rounding in that sum from pruning a pair that ties the bound
+    const double slack = 1.0 + 1e-9;
+    PointPair best;
+    std::vector<std::pair<double, size_t>> farthest(kTreeBatchSize);
+    for (size_t first = 0; first < n; first += kTreeBatchSize)
+    {
+        if (best.found && (radius[order[first]] + radius[order[0]]) * slack < best.distance())
+        {
+            break;
+        }
+        const size_t count = std::min(kTreeBatchSize, n - first);
+        pool.parallelFor(count, [&](size_t k)
+        {
+            farthest[k] = index.farthest(cloud[order[first + k]]);
+        });
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (farthest[k].second != order[first + k])
+            {
+                offerFarthest(best, order[first + k], farthest[k].second, farthest[k].first);
+            }
+        }
+    }
+    return best;
+}
+
+PointPair PairSearch::closestPairBruteForce(const PointCloud &cloud)
+{
+    const DecodedCoordinates coordinates(cloud);
+    PointPair best;
+    for (size_t i = 0; i < cloud.size(); ++i)
+    {
+        for (size_t j = i + 1; j < cloud.size(); ++j)
+        {
+            offerClosest(best, i, j, distanceSquared(coordinates, i, j));
+        }
+    }
+    Profiler::count(Profiler::DistanceEvaluations, uint64_t(cloud.size()) * (cloud.size() - (cloud.size() > 0)) / 2);
+    return best;
+}
+
+PointPair PairSearch::farthestPairBruteForce(const PointCloud &cloud)
+{
+    const DecodedCoordinates coordinates(cloud);
+    PointPair best;
+    for (size_t i = 0; i < cloud.size(); ++i)
+    {
+        for (size_t j = i + 1; j < cloud.size(); ++j)
+        {
+            offerFarthest(best, i, j, distanceSquared(coordinates, i, j));
+        }
+    }
+    Profiler::count(Profiler::DistanceEvaluations, uint64_t(cloud.size()) * (cloud.size() - (cloud.size() > 0)) / 2);
+    return best;
+}
+
+PointPair PairSearch::inSourceOrder(const PointCloud &cloud, PointPair pair)
+{
+    if (pair.found && cloud.sourceIndex(pair.first) > cloud.sourceIndex(pair.second))
+    {
+        std::swap(pair.first, pair.second);
+    }
+    return pair;
+}
+
+double PairSearch::distanceSquared(const DecodedCoordinates &coordinates, size_t a, size_t b)
+{
+    double dx = coordinates.x()[a] - coordinates.x()[b];
+    double dy = coordinates.y()[a] - coordinates.y()[b];
+    double dz = coordinates.z()[a] - coordinates.z()[b];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+void PairSearch::offerClosest(PointPair &best, size_t a, size_t b, double distanceSquared)
+{
+    if (a > b)
+    {
+        std::swap(a, b);
+    }
+    if (!best.found || distanceSquared < best.distanceSquared ||
+        (distanceSquared == best.distanceSquared && std::make_pair(a, b) < std::make_pair(best.first, best.second)))
+    {
+        best.first = a;
+        best.second = b;
+        best.distanceSquared = distanceSquared;
+        best.found = true;
+    }
+}
+
+void PairSearch::offerFarthest(PointPair &best, size_t a, size_t b, double distanceSquared)
+{
+    if (a > b)
+    {
+        std::swap(a, b);
+    }
+    if (!best.found || distanceSquared > best.distanceSquared ||
+        (distanceSquared == best.distanceSquared && std::make_pair(a, b) < std::make_pair(best.first, best.second)))
+    {
+        best.first = a;
+        best.second = b;
+        best.distanceSquared = distanceSquared;
+        best.found = true;
+    }
+}
+
+PointPair PairSearch::closestDuplicatePair(const PointCloud &cloud)
+{
+    // With a zero distance the grid degenerates; find the first repeated point directly
+    struct CoordinateHash
+    {
+        size_t operator()(const Point &p) const
+        {
+            std::hash<double> hash;
+            return hash(p.x) ^ (hash(p.y) * 31) ^ (hash(p.z) * 1009);
+        }
+    };
+    struct CoordinateEqual
+    {
+        bool operator()(const Point &a, const Point &b) const
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }
+    };
+
+    std::unordered_map<Point, size_t, CoordinateHash, CoordinateEqual> firstSeen;
+    firstSeen.reserve(cloud.size());
+    PointPair best;
+    for (size_t j = 0; j < cloud.size(); ++j)
+    {
+        Point point = cloud[j];
+        // -0.0 and 0.0 are the same coordinate but hash differently
+        point.x += 0.0;
+        point.y += 0.0;
+        point.z += 0.0;
+        auto seen = firstSeen.emplace(point, j);
+        if (!seen.second)
+        {
+            offerClosest(best, seen.first->second, j, 0.0);
+        }
+    }
+    return best;
+}
@@ -0,0 +1,97 @@
+#ifndef PAIR_SEARCH_H
+#define PAIR_SEARCH_H
+
+#include <cstddef>
+#include <cmath>
+#include "KDTree.h"
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Two points of a cloud, identified by index, and their squared distance.
+ */
+struct PointPair
+{
+    size_t first = 0;  // The smaller index of the two, see PairSearch::inSourceOrder()
+    size_t second = 0;
+    double distanceSquared = 0;
+    bool found = false;
+
+    double distance() const { return std::sqrt(distanceSquared); }
+};
+
+/**
+ * @brief Closest and farthest pair search over a single point cloud.
+ *
+ * Both searches compare squared distances and take a square root only for
+ * the final answer. When several pairs share the best distance, the pair
+ * with the smallest (first, second) indices is returned, which is the pair
+ * the brute-force double loop finds first.
+ */
+class PairSearch
+{
+public:
+    /**
+     * @brief Closest pair in expected O(n) time.
+     *
+     * Points are inserted in a fixed pseudo-random order into a uniform hash
+     * grid whose cell size is the best distance so far. A point only has to
+     * be compared with the 27 cells around it, and the grid is rebuilt each
+     * time the best distance shrinks.
+     */
+    static PointPair closestPair(const PointCloud &cloud);
+
+    /**
+     * @brief Farthest pair (diameter) by branch and bound.
+     *
+     * A lower bound is seeded from the extreme points along 13 directions.
+     * Points are then visited by decreasing distance r from the bounding box
+     * centre; a pair can only beat the bound when r_a + r_b does, so the
+     * search stops as soon as that sum falls below it. Typical clouds only
+     * compare a small shell of outer points; the worst case (all points on a
+     * sphere) stays O(n^2).
+     */
+    static PointPair farthestPair(const PointCloud &cloud);
+
+    /**
+     * @brief Closest pair from the KD-tree of the cloud, for callers that already hold one.
+     *
+     * Every point asks the tree for its nearest neighbour, spread over
+     * @p pool; the first point with the smallest such distance is then
+     * paired with its first neighbour at that distance. Returns the same
+     * pair as closestPair(const PointCloud &).
+     */
+    static PointPair closestPair(const KDTree &index, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Farthest pair from the KD-tree of the cloud, for callers that already hold one.
+     *
+     * Points are visited by decreasing distance r from the bounding box
+     * centre, a batch at a time on @p pool, and each asks the tree for its
+     * farthest point. The search stops once r plus the largest radius falls
+     * below the best distance. Returns the same pair as
+     * farthestPair(const PointCloud &).
+     */
+    static PointPair farthestPair(const KDTree &index, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Reference O(n^2) versions, also used for very small clouds.
+     */
+    static PointPair closestPairBruteForce(const PointCloud &cloud);
+    static PointPair farthestPairBruteForce(const PointCloud &cloud);
+
+    /**
+     * @brief Swaps the points of @p pair if needed so the one read first from the file comes first.
+     *
+     * Only changes anything for clouds that were reordered.
+     */
+    static PointPair inSourceOrder(const PointCloud &cloud, PointPair pair);
+
+private:
+    static double distanceSquared(const DecodedCoordinates &coordinates, size_t a, size_t b);
+    static void offerClosest(PointPair &best, size_t a, size_t b, double distanceSquared);
+    static void offerFarthest(PointPair &best, size_t a, size_t b, double distanceSquared);
+    static PointPair closestDuplicatePair(const PointCloud &cloud);
+};
+
+#endif // PAIR_SEARCH_H
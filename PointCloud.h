@@ -0,0 +1,656 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <cmath>
+#include <string>
+#include "MemoryBudget.h"
+#include "Point.h"
+
+/**
+ * @brief Structure-of-arrays container for the points of one file.
+ *
+ * Each axis is stored in its own contiguous array, so kernels that sweep
+ * one coordinate at a time (distances, bounding boxes) read memory linearly
+ * and can be vectorized. Files in the "x y z r g b" format also keep their
+ * colour as three bytes per point.
+ *
+ * Coordinates are doubles while a cloud is built. compact() can then
+ * re-encode them as float32 offsets from the bounding box minimum, or as
+ * 16 or 32-bit integers quantized over the bounding box, which cuts the
+ * coordinate memory to a half (float32, quantized32) or a quarter
+ * (quantized16). Compact clouds are
+ * read through operator[] and decode(); xData() and friends are only
+ * available for Storage::Double.
+ *
+ * A cloud can be permuted (see SpatialOrder) and then remembers the data
+ * row each point came from, so results can still name source rows.
+ *
+ * All arrays are allocated through a BudgetAllocator, so the cloud's
+ * storage counts against the MemoryBudget and is tracked by the cloud's
+ * account, which derived data (the KD-tree, chunk clouds) can share.
+ *
+ * Indexing and iteration produce Point values, so code written against
+ * std::vector<Point> keeps working.
+ */
+class PointCloud
+{
+public:
+    enum class Storage
+    {
+        Double,      // 8 bytes per coordinate, exact
+        Float32,     // 4 bytes, float offset from the bounding box minimum
+        Quantized16, // 2 bytes, 65536 levels across the bounding box
+        Quantized32  // 4 bytes, 2^32 levels across the bounding box
+    };
+
+    template <typename T>
+    using Array = std::vector<T, BudgetAllocator<T>>;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Point;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Point;
+
+        const_iterator(const PointCloud *cloud, size_t index) : cloud_(cloud), index_(index) {}
+
+        Point operator*() const { return (*cloud_)[index_]; }
+        Point operator[](difference_type offset) const { return (*cloud_)[index_ + offset]; }
+        const_iterator &operator++() { ++index_; return *this; }
+        const_iterator operator++(int) { const_iterator previous = *this; ++index_; return previous; }
+        const_iterator &operator--() { --index_; return *this; }
+        const_iterator &operator+=(difference_type offset) { index_ += offset; return *this; }
+        const_iterator operator+(difference_type offset) const { return const_iterator(cloud_, index_ + offset); }
+        difference_type operator-(const const_iterator &other) const { return difference_type(index_) - difference_type(other.index_); }
+        bool operator==(const const_iterator &other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator &other) const { return index_ != other.index_; }
+        bool operator<(const const_iterator &other) const { return index_ < other.index_; }
+        size_t index() const { return index_; }
+
+    private:
+        const PointCloud *cloud_;
+        size_t index_;
+    };
+
+    /**
+     * @brief An empty cloud with an account of its own, or charging @p account.
+     */
+    PointCloud() : PointCloud(std::make_shared<MemoryBudget::Account>()) {}
+    explicit PointCloud(const std::shared_ptr<MemoryBudget::Account> &account);
+
+    /**
+     * @brief The account the cloud's storage is charged to.
+     */
+    std::shared_ptr<MemoryBudget::Account> account() const { return x_.get_allocator().account(); }
+
+    /**
+     * @brief An allocator charging the cloud's account, for storage derived from the cloud.
+     */
+    template <typename T>
+    BudgetAllocator<T> allocator() const { return BudgetAllocator<T>(account()); }
+
+    size_t size() const { return storage_ == Storage::Double ? x_.size() : compactSize_; }
+    bool empty() const { return size() == 0; }
+    bool hasColor() const { return withColor_; }
+    Storage storage() const { return storage_; }
+
+    /**
+     * @brief Reserves room for @p count points and decides whether colour is kept.
+     *
+     * Points can only be added while the storage is Storage::Double.
+     */
+    void reserve(size_t count, bool withColor);
+    void add(const Point &point);
+    void add(const Point &point, uint32_t rgb);
+    void append(const PointCloud &other);
+    void shrinkToFit();
+
+    /**
+     * @brief Removes all points but keeps the allocated storage for reuse.
+     *
+     * The storage goes back to Storage::Double.
+     */
+    void clear();
+
+    /**
+     * @brief Re-encodes the coordinates of a Storage::Double cloud in @p storage.
+     *
+     * The quantized storages use the per-axis bounding box of the cloud.
+     */
+    void compact(Storage storage);
+
+    /**
+     * @brief Largest difference between a stored and an original coordinate, 0 for doubles.
+     */
+    double maxError() const;
+
+    /**
+     * @brief Writes the coordinates of the points [begin, end) as doubles, whatever the storage.
+     */
+    void decode(size_t begin, size_t end, double *xs, double *ys, double *zs) const;
+
+    /**
+     * @brief Reorders a Storage::Double cloud so that point i is the former point order[i].
+     *
+     * The source rows are carried along, see sourceIndex().
+     */
+    void permute(const Array<uint32_t> &order);
+
+    /**
+     * @brief Data row (0-based, in file order) that point @p index was read from.
+     */
+    size_t sourceIndex(size_t index) const { return sourceIndex_.empty() ? index : sourceIndex_[index]; }
+    bool reordered() const { return !sourceIndex_.empty(); }
+
+    /**
+     * @brief Sorts point indices into the order of their source rows.
+     */
+    void sortBySource(std::vector<size_t> &indices) const
+    {
+        if (sourceIndex_.empty())
+        {
+            std::sort(indices.begin(), indices.end());
+            return;
+        }
+        std::sort(indices.begin(), indices.end(),
+                  [this](size_t a, size_t b) { return sourceIndex_[a] < sourceIndex_[b]; });
+    }
+
+    /**
+     * @brief Parses "double", "float32", "quantized16" or "quantized32".
+     */
+    static bool parseStorage(const std::string &name, Storage &storage);
+    static const char *storageName(Storage storage);
+
+    /**
+     * @brief Per-axis minimum and maximum of the points [begin, end).
+     */
+    void bounds(size_t begin, size_t end, Point &low, Point &high) const;
+
+    Point operator[](size_t index) const
+    {
+        if (storage_ == Storage::Double)
+        {
+            return Point{x_[index], y_[index], z_[index]};
+        }
+        return Point{coordinate(0, index), coordinate(1, index), coordinate(2, index)};
+    }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    // Storage::Double only
+    const double *xData() const { return x_.data(); }
+    const double *yData() const { return y_.data(); }
+    const double *zData() const { return z_.data(); }
+
+    /**
+     * @brief Packed 0x00RRGGBB colour of a point, 0 for files without colour.
+     */
+    uint32_t color(size_t index) const
+    {
+        return colors_.empty() ? 0 : packColor(colors_[3 * index], colors_[3 * index + 1], colors_[3 * index + 2]);
+    }
+
+    /**
+     * @brief Indices of the points whose r, g and b lie within the given inclusive ranges.
+     */
+    std::vector<size_t> selectByColor(const unsigned char minRgb[3], const unsigned char maxRgb[3]) const;
+
+    /**
+     * @brief Bytes held by the coordinate and colour arrays.
+     */
+    size_t memoryBytes() const;
+
+    static uint32_t packColor(unsigned char r, unsigned char g, unsigned char b)
+    {
+        return (uint32_t(r) << 16) | (uint32_t(g) << 8) | uint32_t(b);
+    }
+    static void unpackColor(uint32_t rgb, unsigned char out[3])
+    {
+        out[0] = static_cast<unsigned char>(rgb >> 16);
+        out[1] = static_cast<unsigned char>(rgb >> 8);
+        out[2] = static_cast<unsigned char>(rgb);
+    }
+
+    /**
+     * @brief Coordinate @p axis (0 for x, 1 for y, 2 for z) of point @p index, whatever the storage.
+     */
+    double coordinate(int axis, size_t index) const;
+
+private:
+    void addColor(uint32_t rgb);
+
+    template <typename Stored>
+    static void decodeAxis(const Array<Stored> &values, double origin, double step,
+                           size_t begin, size_t end, double *out);
+
+    Array<double> x_, y_, z_;
+    Array<unsigned char> colors_; // r g b per point
+    bool withColor_ = false;
+    Array<uint32_t> sourceIndex_; // Empty while the points are in file order
+
+    // Compact coordinates, coordinate = origin_ + step_ * stored value
+    Storage storage_ = Storage::Double;
+    size_t compactSize_ = 0;
+    double origin_[3] = {0, 0, 0};
+    double step_[3] = {1, 1, 1};
+    Array<float> floats_[3];
+    Array<uint16_t> quantized16_[3];
+    Array<uint32_t> quantized32_[3];
+};
+
+/**
+ * @brief The coordinates of a cloud as three double arrays.
+ *
+ * Points at the cloud's own arrays for Storage::Double and holds a decoded
+ * copy otherwise, for the random-access kernels that need plain doubles.
+ * The copy is charged to the cloud's account like the cloud itself.
+ */
+class DecodedCoordinates
+{
+public:
+    explicit DecodedCoordinates(const PointCloud &cloud);
+    DecodedCoordinates(const DecodedCoordinates &) = delete;
+    DecodedCoordinates &operator=(const DecodedCoordinates &) = delete;
+
+    const double *x() const { return xs_; }
+    const double *y() const { return ys_; }
+    const double *z() const { return zs_; }
+
+private:
+    PointCloud::Array<double> x_, y_, z_;
+    const double *xs_, *ys_, *zs_;
+};
+
+inline PointCloud::PointCloud(const std::shared_ptr<MemoryBudget::Account> &account)
+    : x_(account), y_(account), z_(account), colors_(account), sourceIndex_(account)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        floats_[axis] = Array<float>(account);
+        quantized16_[axis] = Array<uint16_t>(account);
+        quantized32_[axis] = Array<uint32_t>(account);
+    }
+}
+
+inline void PointCloud::reserve(size_t count, bool withColor)
+{
+    withColor_ = withColor;
+    x_.reserve(count);
+    y_.reserve(count);
+    z_.reserve(count);
+    if (withColor)
+    {
+        colors_.reserve(3 * count);
+    }
+}
+
+inline void PointCloud::addColor(uint32_t rgb)
+{
+    unsigned char channels[3];
+    unpackColor(rgb, channels);
+    colors_.insert(colors_.end(), channels, channels + 3);
+}
+
+inline void PointCloud::add(const Point &point)
+{
+    add(point, 0);
+}
+
+inline void PointCloud::add(const Point &point, uint32_t rgb)
+{
+    if (!sourceIndex_.empty())
+    {
+        // Points added after a permutation come after every earlier row
+        sourceIndex_.push_back(static_cast<uint32_t>(x_.size()));
+    }
+    x_.push_back(point.x);
+    y_.push_back(point.y);
+    z_.push_back(point.z);
+    if (withColor_)
+    {
+        addColor(rgb);
+    }
+}
+
+inline void PointCloud::append(const PointCloud &other)
+{
+    for (size_t i = 0; !sourceIndex_.empty() && i < other.size(); ++i)
+    {
+        sourceIndex_.push_back(static_cast<uint32_t>(x_.size() + other.sourceIndex(i)));
+    }
+    x_.insert(x_.end(), other.x_.begin(), other.x_.end());
+    y_.insert(y_.end(), other.y_.begin(), other.y_.end());
+    z_.insert(z_.end(), other.z_.begin(), other.z_.end());
+    if (withColor_)
+    {
+        if (other.withColor_)
+        {
+            colors_.insert(colors_.end(), other.colors_.begin(), other.colors_.end());
+        }
+        else
+        {
+            colors_.resize(3 * x_.size(), 0);
+        }
+    }
+}
+
+inline void PointCloud::shrinkToFit()
+{
+    x_.shrink_to_fit();
+    y_.shrink_to_fit();
+    z_.shrink_to_fit();
+    colors_.shrink_to_fit();
+    sourceIndex_.shrink_to_fit();
+}
+
+inline void PointCloud::permute(const Array<uint32_t> &order)
+{
+    Array<double> *axes[3] = {&x_, &y_, &z_};
+    Array<double> values(order.size(), 0.0, x_.get_allocator());
+    for (Array<double> *axis : axes)
+    {
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            values[i] = (*axis)[order[i]];
+        }
+        axis->swap(values);
+    }
+    if (!colors_.empty())
+    {
+        Array<unsigned char> colors(colors_.size(), 0, colors_.get_allocator());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            std::copy(&colors_[3 * order[i]], &colors_[3 * order[i]] + 3, &colors[3 * i]);
+        }
+        colors_.swap(colors);
+    }
+    Array<uint32_t> sources(order.size(), 0, sourceIndex_.get_allocator());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        sources[i] = static_cast<uint32_t>(sourceIndex(order[i]));
+    }
+    sourceIndex_.swap(sources);
+}
+
+inline void PointCloud::bounds(size_t begin, size_t end, Point &low, Point &high) const
+{
+    low = Point{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    high = Point{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+
+    // Compact clouds are decoded a block at a time
+    const size_t kBlock = 1024;
+    double blockX[kBlock], blockY[kBlock], blockZ[kBlock];
+    while (begin < end)
+    {
+        const size_t count = storage_ == Storage::Double ? end - begin : std::min(end - begin, kBlock);
+        const double *xs = x_.data() + begin, *ys = y_.data() + begin, *zs = z_.data() + begin;
+        if (storage_ != Storage::Double)
+        {
+            decode(begin, begin + count, blockX, blockY, blockZ);
+            xs = blockX;
+            ys = blockY;
+            zs = blockZ;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            low.x = std::min(low.x, xs[i]);
+            low.y = std::min(low.y, ys[i]);
+            low.z = std::min(low.z, zs[i]);
+            high.x = std::max(high.x, xs[i]);
+            high.y = std::max(high.y, ys[i]);
+            high.z = std::max(high.z, zs[i]);
+        }
+        begin += count;
+    }
+}
+
+inline void PointCloud::clear()
+{
+    x_.clear();
+    y_.clear();
+    z_.clear();
+    colors_.clear();
+    sourceIndex_.clear();
+    storage_ = Storage::Double;
+    compactSize_ = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        floats_[axis].clear();
+        quantized16_[axis].clear();
+        quantized32_[axis].clear();
+    }
+}
+
+inline void PointCloud::compact(Storage storage)
+{
+    if (storage_ != Storage::Double || storage == Storage::Double)
+    {
+        return;
+    }
+    const size_t n = x_.size();
+    Point low, high;
+    bounds(0, n, low, high);
+    const double lows[3] = {low.x, low.y, low.z};
+    const double highs[3] = {high.x, high.y, high.z};
+    Array<double> *axes[3] = {&x_, &y_, &z_};
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const Array<double> &values = *axes[axis];
+        origin_[axis] = n > 0 ? lows[axis] : 0;
+        if (storage == Storage::Float32)
+        {
+            step_[axis] = 1;
+            floats_[axis].resize(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                floats_[axis][i] = static_cast<float>(values[i] - origin_[axis]);
+            }
+            continue;
+        }
+
+        const double levels = storage == Storage::Quantized16 ? 65535.0 : 4294967295.0;
+        const double extent = n > 0 ? highs[axis] - lows[axis] : 0;
+        step_[axis] = extent > 0 ? extent / levels : 0;
+        const double inverseStep = extent > 0 ? levels / extent : 0;
+        if (storage == Storage::Quantized16)
+        {
+            quantized16_[axis].resize(n);
+        }
+        else
+        {
+            quantized32_[axis].resize(n);
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            double level = std::min(std::floor((values[i] - origin_[axis]) * inverseStep + 0.5), levels);
+            if (storage == Storage::Quantized16)
+            {
+                quantized16_[axis][i] = static_cast<uint16_t>(level);
+            }
+            else
+            {
+                quantized32_[axis][i] = static_cast<uint32_t>(level);
+            }
+        }
+    }
+
+    storage_ = storage;
+    compactSize_ = n;
+    Array<double>(x_.get_allocator()).swap(x_);
+    Array<double>(y_.get_allocator()).swap(y_);
+    Array<double>(z_.get_allocator()).swap(z_);
+}
+
+inline double PointCloud::maxError() const
+{
+    double error = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (storage_ == Storage::Quantized16 || storage_ == Storage::Quantized32)
+        {
+            error = std::max(error, step_[axis] / 2);
+        }
+        else if (storage_ == Storage::Float32)
+        {
+            // Half a float ulp at the largest offset stored
+            float largest = 0;
+            for (float value : floats_[axis])
+            {
+                largest = std::max(largest, value);
+            }
+            error = std::max(error, double(largest) * std::numeric_limits<float>::epsilon() / 2);
+        }
+    }
+    return error;
+}
+
+inline double PointCloud::coordinate(int axis, size_t index) const
+{
+    switch (storage_)
+    {
+    case Storage::Float32:
+        return origin_[axis] + floats_[axis][index];
+    case Storage::Quantized16:
+        return origin_[axis] + step_[axis] * quantized16_[axis][index];
+    case Storage::Quantized32:
+        return origin_[axis] + step_[axis] * quantized32_[axis][index];
+    default:
+        return axis == 0 ? x_[index] : (axis == 1 ? y_[index] : z_[index]);
+    }
+}
+
+template <typename Stored>
+inline void PointCloud::decodeAxis(const Array<Stored> &values, double origin, double step,
+                                   size_t begin, size_t end, double *out)
+{
+    const Stored *stored = values.data();
+    for (size_t i = begin; i < end; ++i)
+    {
+        out[i - begin] = origin + step * stored[i];
+    }
+}
+
+inline void PointCloud::decode(size_t begin, size_t end, double *xs, double *ys, double *zs) const
+{
+    double *outputs[3] = {xs, ys, zs};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        switch (storage_)
+        {
+        case Storage::Float32:
+            decodeAxis(floats_[axis], origin_[axis], 1.0, begin, end, outputs[axis]);
+            break;
+        case Storage::Quantized16:
+            decodeAxis(quantized16_[axis], origin_[axis], step_[axis], begin, end, outputs[axis]);
+            break;
+        case Storage::Quantized32:
+            decodeAxis(quantized32_[axis], origin_[axis], step_[axis], begin, end, outputs[axis]);
+            break;
+        default:
+        {
+            const Array<double> &values = axis == 0 ? x_ : (axis == 1 ? y_ : z_);
+            std::copy(values.begin() + begin, values.begin() + end, outputs[axis]);
+        }
+        }
+    }
+}
+
+inline bool PointCloud::parseStorage(const std::string &name, Storage &storage)
+{
+    if (name == "double")
+    {
+        storage = Storage::Double;
+    }
+    else if (name == "float32")
+    {
+        storage = Storage::Float32;
+    }
+    else if (name == "quantized16")
+    {
+        storage = Storage::Quantized16;
+    }
+    else if (name == "quantized32")
+    {
+        storage = Storage::Quantized32;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+inline const char *PointCloud::storageName(Storage storage)
+{
+    switch (storage)
+    {
+    case Storage::Float32:
+        return "float32";
+    case Storage::Quantized16:
+        return "quantized16";
+    case Storage::Quantized32:
+        return "quantized32";
+    default:
+        return "double";
+    }
+}
+
+inline DecodedCoordinates::DecodedCoordinates(const PointCloud &cloud)
+    : x_(cloud.allocator<double>()), y_(cloud.allocator<double>()), z_(cloud.allocator<double>())
+{
+    if (cloud.storage() == PointCloud::Storage::Double)
+    {
+        xs_ = cloud.xData();
+        ys_ = cloud.yData();
+        zs_ = cloud.zData();
+        return;
+    }
+    x_.resize(cloud.size());
+    y_.resize(cloud.size());
+    z_.resize(cloud.size());
+    cloud.decode(0, cloud.size(), x_.data(), y_.data(), z_.data());
+    xs_ = x_.data();
+    ys_ = y_.data();
+    zs_ = z_.data();
+}
+
+inline std::vector<size_t> PointCloud::selectByColor(const unsigned char minRgb[3], const unsigned char maxRgb[3]) const
+{
+    std::vector<size_t> selected;
+    for (size_t i = 0; 3 * i < colors_.size(); ++i)
+    {
+        const unsigned char *rgb = &colors_[3 * i];
+        if (rgb[0] >= minRgb[0] && rgb[0] <= maxRgb[0] &&
+            rgb[1] >= minRgb[1] && rgb[1] <= maxRgb[1] &&
+            rgb[2] >= minRgb[2] && rgb[2] <= maxRgb[2])
+        {
+            selected.push_back(i);
+        }
+    }
+    return selected;
+}
+
+inline size_t PointCloud::memoryBytes() const
+{
+    size_t bytes = (x_.capacity() + y_.capacity() + z_.capacity()) * sizeof(double) + colors_.capacity() +
+                   sourceIndex_.capacity() * sizeof(uint32_t);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        bytes += floats_[axis].capacity() * sizeof(float) + quantized16_[axis].capacity() * sizeof(uint16_t) +
+                 quantized32_[axis].capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+#endif // POINT_CLOUD_H
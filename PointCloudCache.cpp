@@ -0,0 +1,263 @@
+#include "PointCloudCache.h"
+#include "PointLoader.h"
+#include "Profiler.h"
+#include <sys/stat.h>
+
+PointCloudCache::PointCloudCache(size_t capacityBytes)
+    : capacity_(capacityBytes)
+{
+}
+
+std::shared_ptr<const PointCloud> PointCloudCache::get(const std::string &filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(filename);
+        if (found != index_.end())
+        {
+            auto entry = found->second;
+            if (entry->modified == info.st_mtime && entry->fileSize == info.st_size)
+            {
+                entries_.splice(entries_.begin(), entries_, entry);
+                return entry->cloud;
+            }
+            // The file changed on disk, drop the stale copy
+            usage_ -= entry->bytes;
+            entries_.erase(entry);
+            index_.erase(found);
+        }
+    }
+
+    PointFileHeader header;
+    if (!PointLoader::readHeader(filename, header))
+    {
+        return nullptr;
+    }
+    if (!makeRoom(estimateBytes(header)))
+    {
+        setOverBudget(filename, true);
+        return nullptr;
+    }
+
+    // Load outside the lock so other files can be served meanwhile
+    auto cloud = std::make_shared<PointCloud>();
+    PointCloud::Storage storage;
+    SpatialOrder::Curve curve;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        storage = storage_;
+        curve = curve_;
+    }
+    try
+    {
+        {
+            Profiler::Scope scope(filename, "load");
+            if (!PointLoader::loadPoints(filename, *cloud))
+            {
+                return nullptr;
+            }
+            cloud->shrinkToFit();
+            Profiler::count(Profiler::PeakBytes, cloud->account()->peak());
+        }
+        if (curve != SpatialOrder::Curve::None)
+        {
+            Profiler::Scope scope(filename, "reorder");
+            SpatialOrder::reorder(*cloud, curve);
+            Profiler::count(Profiler::PeakBytes, cloud->account()->peak());
+        }
+        if (storage != PointCloud::Storage::Double)
+        {
+            Profiler::Scope scope(filename, "compact");
+            cloud->compact(storage);
+            Profiler::count(Profiler::PeakBytes, cloud->account()->peak());
+        }
+    }
+    catch (const BudgetExceeded &)
+    {
+        setOverBudget(filename, true);
+        return nullptr;
+    }
+    setOverBudget(filename, false);
+    size_t bytes = cloud->memoryBytes();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes > capacity_ || index_.count(filename) != 0)
+    {
+        // Too large to keep, or another caller cached it first
+        return cloud;
+    }
+    entries_.push_front(Entry{filename, info.st_mtime, info.st_size, bytes, cloud, nullptr});
+    index_[filename] = entries_.begin();
+    usage_ += bytes;
+    evictToCapacity();
+    return cloud;
+}
+
+std::shared_ptr<const KDTree> PointCloudCache::getIndex(const std::string &filename)
+{
+    std::shared_ptr<const PointCloud> cloud = get(filename);
+    if (!cloud)
+    {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(filename);
+        if (found != index_.end() && found->second->cloud == cloud && found->second->index)
+        {
+            return found->second->index;
+        }
+    }
+
+    // The order, plus a copy of the coordinates in tree order unless the cloud is compact
+    const size_t bytesPerPoint = sizeof(size_t) + (cloud->storage() == PointCloud::Storage::Double ? 3 * sizeof(double) : 0);
+    std::shared_ptr<const KDTree> index;
+    try
+    {
+        if (!makeRoom(cloud->size() * bytesPerPoint))
+        {
+            throw BudgetExceeded();
+        }
+        Profiler::Scope scope(filename, "index");
+        index = std::make_shared<const KDTree>(cloud);
+        Profiler::count(Profiler::PeakBytes, cloud->account()->peak());
+    }
+    catch (const BudgetExceeded &)
+    {
+        setOverBudget(filename, true);
+        return nullptr;
+    }
+    size_t bytes = index->memoryBytes();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(filename);
+    if (found == index_.end() || found->second->cloud != cloud)
+    {
+        // The cloud is too large to cache or was replaced meanwhile
+        return index;
+    }
+    if (found->second->index)
+    {
+        // Another caller indexed it first
+        return found->second->index;
+    }
+    found->second->index = index;
+    found->second->bytes += bytes;
+    usage_ += bytes;
+    evictToCapacity();
+    return index;
+}
+
+bool PointCloudCache::exceedsBudget(const std::string &filename) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overBudget_.count(filename) != 0;
+}
+
+size_t PointCloudCache::estimateBytes(const PointFileHeader &header)
+{
+    return size_t(std::max(header.pointCount, 0)) * (3 * sizeof(double) + (header.hasColor ? 3 : 0));
+}
+
+void PointCloudCache::setCapacity(size_t capacityBytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacityBytes;
+    evictToCapacity();
+}
+
+size_t PointCloudCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+void PointCloudCache::setStorage(PointCloud::Storage storage)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (storage != storage_)
+    {
+        storage_ = storage;
+        entries_.clear();
+        index_.clear();
+        usage_ = 0;
+    }
+}
+
+void PointCloudCache::setReorder(SpatialOrder::Curve curve)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (curve != curve_)
+    {
+        curve_ = curve;
+        entries_.clear();
+        index_.clear();
+        usage_ = 0;
+    }
+}
+
+PointCloud::Storage PointCloudCache::storage() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return storage_;
+}
+
+size_t PointCloudCache::usage() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return usage_;
+}
+
+void PointCloudCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    usage_ = 0;
+}
+
+void PointCloudCache::evictToCapacity()
+{
+    // Callers still holding an evicted cloud keep it alive through their shared_ptr
+    while (usage_ > capacity_ && !entries_.empty())
+    {
+        const Entry &oldest = entries_.back();
+        usage_ -= oldest.bytes;
+        index_.erase(oldest.filename);
+        entries_.pop_back();
+    }
+}
+
+bool PointCloudCache::makeRoom(size_t bytes)
+{
+    // Evicted clouds only give their memory back once no caller holds them
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!MemoryBudget::fits(bytes) && !entries_.empty())
+    {
+        const Entry &oldest = entries_.back();
+        usage_ -= oldest.bytes;
+        index_.erase(oldest.filename);
+        entries_.pop_back();
+    }
+    return MemoryBudget::fits(bytes);
+}
+
+void PointCloudCache::setOverBudget(const std::string &filename, bool overBudget)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (overBudget)
+    {
+        overBudget_.insert(filename);
+    }
+    else
+    {
+        overBudget_.erase(filename);
+    }
+}
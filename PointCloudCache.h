@@ -0,0 +1,110 @@
+#ifndef POINT_CLOUD_CACHE_H
+#define POINT_CLOUD_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include "PointCloud.h"
+#include "KDTree.h"
+#include "SpatialOrder.h"
+
+struct PointFileHeader;
+
+/**
+ * @brief In-process cache of loaded point files shared by all menu operations.
+ *
+ * Entries are keyed by path and remember the file's modification time and
+ * size, so a file that changed on disk is loaded again. Files are loaded
+ * lazily on first use and the least recently used entries are evicted once
+ * the cached points exceed the capacity. The KD-tree of a file is built on
+ * its first spatial query and kept with the points. Loaded clouds are
+ * optionally sorted along a space-filling curve and then compacted to the
+ * configured storage before they are cached.
+ *
+ * Clouds and trees are charged to the MemoryBudget. Before a file is loaded
+ * its size is estimated from the header and cached entries are evicted
+ * until it fits; a file that still does not fit, or that runs out of budget
+ * while loading or indexing, is refused and reported by exceedsBudget().
+ * Files loaded or held by concurrent callers share the budget.
+ */
+class PointCloudCache
+{
+public:
+    static const size_t kDefaultCapacityBytes = size_t(512) << 20;
+
+    explicit PointCloudCache(size_t capacityBytes = kDefaultCapacityBytes);
+
+    /**
+     * @brief Returns the points of @p filename, loading them if needed.
+     *
+     * @return nullptr if the file could not be read or does not fit in the memory budget.
+     */
+    std::shared_ptr<const PointCloud> get(const std::string &filename);
+
+    /**
+     * @brief Returns the KD-tree of @p filename, building it on first use.
+     *
+     * @return nullptr if the file could not be read or its points or tree do not fit in the memory budget.
+     */
+    std::shared_ptr<const KDTree> getIndex(const std::string &filename);
+
+    /**
+     * @brief Whether the last attempt to load or index @p filename was refused for lack of memory budget.
+     */
+    bool exceedsBudget(const std::string &filename) const;
+
+    /**
+     * @brief Bytes a Storage::Double cloud of the file with @p header takes, 0 if the header has no count.
+     */
+    static size_t estimateBytes(const PointFileHeader &header);
+
+    void setCapacity(size_t capacityBytes);
+    size_t capacity() const;
+
+    /**
+     * @brief Sets the coordinate storage of clouds loaded from now on; drops the cached ones.
+     */
+    void setStorage(PointCloud::Storage storage);
+    PointCloud::Storage storage() const;
+
+    /**
+     * @brief Sets the curve clouds loaded from now on are sorted along; drops the cached ones.
+     */
+    void setReorder(SpatialOrder::Curve curve);
+    size_t usage() const;
+    void clear();
+
+private:
+    struct Entry
+    {
+        std::string filename;
+        time_t modified;
+        off_t fileSize;
+        size_t bytes;
+        std::shared_ptr<const PointCloud> cloud;
+        std::shared_ptr<const KDTree> index;
+    };
+
+    void evictToCapacity();
+
+    /**
+     * @brief Evicts least recently used entries until @p bytes fit in the memory budget.
+     */
+    bool makeRoom(size_t bytes);
+    void setOverBudget(const std::string &filename, bool overBudget);
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    size_t usage_ = 0;
+    PointCloud::Storage storage_ = PointCloud::Storage::Double;
+    SpatialOrder::Curve curve_ = SpatialOrder::Curve::None;
+    std::list<Entry> entries_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::unordered_set<std::string> overBudget_;
+};
+
+#endif // POINT_CLOUD_CACHE_H
@@ -0,0 +1,149 @@
+#include "PointGenerator.h"
+#include "BinaryPointFile.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+bool PointGenerator::write(const std::string &filename, const Options &options)
+{
+    if (options.count == 0 || options.count > kMaxCount || !(options.extent > 0))
+    {
+        return false;
+    }
+
+    std::FILE *out = std::fopen(filename.c_str(), "wb");
+    if (out == nullptr)
+    {
+        return false;
+    }
+    std::fprintf(out, "VERSION 1\nFORMAT %s\nPOINTS %zu\nDATA %s\n", options.withColor ? "x y z r g b" : "x y z",
+                 options.count, options.binary ? "binary" : "ascii");
+
+    std::mt19937_64 random(options.seed);
+    std::uniform_real_distribution<double> coordinate(0, options.extent);
+    std::uniform_int_distribution<int> channel(0, 255);
+    std::normal_distribution<double> spread(0, options.extent / 50);
+
+    Point centres[kClusterCount];
+    for (Point &centre : centres)
+    {
+        centre = Point{coordinate(random), coordinate(random), coordinate(random)};
+    }
+    std::uniform_int_distribution<int> cluster(0, kClusterCount - 1);
+
+    std::vector<char> buffer;
+    buffer.reserve((1 << 20) + 128);
+    bool writeOk = true;
+    for (size_t i = 0; i < options.count; ++i)
+    {
+        Point point{};
+        switch (options.distribution)
+        {
+        case Uniform:
+            point = Point{coordinate(random), coordinate(random), coordinate(random)};
+            break;
+        case Clustered:
+        {
+            const Point &centre = centres[cluster(random)];
+            point = Point{centre.x + spread(random), centre.y + spread(random), centre.z + spread(random)};
+            break;
+        }
+        case Planar:
+            point.x = coordinate(random);
+            point.y = coordinate(random);
+            point.z = 0.25 * point.x + 0.5 * point.y + spread(random) / 10;
+            break;
+        }
+        unsigned char rgb[3] = {0, 0, 0};
+        if (options.withColor)
+        {
+            rgb[0] = static_cast<unsigned char>(channel(random));
+            rgb[1] = static_cast<unsigned char>(channel(random));
+            rgb[2] = static_cast<unsigned char>(channel(random));
+        }
+
+        size_t offset = buffer.size();
+        if (options.binary)
+        {
+            buffer.resize(offset + BinaryPointFile::recordSize(options.withColor));
+            unsigned char *record = reinterpret_cast<unsigned char *>(&buffer[offset]);
+            BinaryPointFile::storeDouble(point.x, record);
+            BinaryPointFile::storeDouble(point.y, record + 8);
+            BinaryPointFile::storeDouble(point.z, record + 16);
+            if (options.withColor)
+            {
+                std::memcpy(record + 24, rgb, 3);
+            }
+        }
+        else
+        {
+            // Shortest representation that reads back to the same double
+            buffer.resize(offset + 128);
+            char *cursor = &buffer[offset];
+            char *end = cursor + 128;
+            const double values[3] = {point.x, point.y, point.z};
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                cursor = std::to_chars(cursor, end, values[axis]).ptr;
+                *cursor++ = ' ';
+            }
+            for (int c = 0; options.withColor && c < 3; ++c)
+            {
+                cursor = std::to_chars(cursor, end, int(rgb[c])).ptr;
+                *cursor++ = ' ';
+            }
+            cursor[-1] = '\n';
+            buffer.resize(cursor - buffer.data());
+        }
+
+        if (buffer.size() >= (1 << 20))
+        {
+            writeOk = writeOk && std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+            buffer.clear();
+        }
+    }
+
+    writeOk = writeOk && std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+    writeOk = std::fclose(out) == 0 && writeOk;
+    if (!writeOk)
+    {
+        std::remove(filename.c_str());
+    }
+    return writeOk;
+}
+
+bool PointGenerator::parseDistribution(const std::string &name, Distribution &distribution)
+{
+    if (name == "uniform")
+    {
+        distribution = Uniform;
+    }
+    else if (name == "clustered")
+    {
+        distribution = Clustered;
+    }
+    else if (name == "planar")
+    {
+        distribution = Planar;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char *PointGenerator::distributionName(Distribution distribution)
+{
+    switch (distribution)
+    {
+    case Clustered:
+        return "clustered";
+    case Planar:
+        return "planar";
+    default:
+        return "uniform";
+    }
+}
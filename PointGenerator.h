@@ -0,0 +1,52 @@
+#ifndef POINT_GENERATOR_H
+#define POINT_GENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Writes synthetic point files of any size for testing and benchmarking.
+ *
+ * Points are generated and written in blocks, so even 10^8 points need only
+ * a few megabytes of memory. The same options and seed always produce the
+ * same file.
+ */
+class PointGenerator
+{
+public:
+    enum Distribution
+    {
+        Uniform,   // Uniform in the cube [0, extent]^3
+        Clustered, // Gaussian blobs around kClusterCount random centres
+        Planar     // Close to a tilted plane through the cube, a degenerate case for spatial indexes
+    };
+
+    struct Options
+    {
+        size_t count = 1000;
+        Distribution distribution = Uniform;
+        bool withColor = false;
+        bool binary = false; // Write a DATA binary section instead of ascii rows
+        uint64_t seed = 1;
+        double extent = 100;
+    };
+
+    static constexpr size_t kMaxCount = 100000000;
+    static constexpr int kClusterCount = 16;
+
+    /**
+     * @brief Writes a valid .pt file with the requested points to @p filename.
+     *
+     * @return false if the options are out of range or the file could not be written.
+     */
+    static bool write(const std::string &filename, const Options &options);
+
+    /**
+     * @brief Parses "uniform", "clustered" or "planar".
+     */
+    static bool parseDistribution(const std::string &name, Distribution &distribution);
+    static const char *distributionName(Distribution distribution);
+};
+
+#endif // POINT_GENERATOR_H
@@ -0,0 +1,250 @@
+#include "PointLoader.h"
+#include "Utils.h"
+#include "BinaryPointFile.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <charconv>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool PointLoader::loadPoints(const std::string &filename, PointCloud &cloud)
+{
+    PointFileHeader header;
+    if (!readHeader(filename, header))
+    {
+        return false;
+    }
+    if (header.binary)
+    {
+        bool loaded = BinaryPointFile::loadPoints(filename, cloud);
+        Profiler::count(Profiler::BytesRead, cloud.size() * BinaryPointFile::recordSize(header.hasColor));
+        Profiler::count(Profiler::PointsKept, cloud.size());
+        return loaded;
+    }
+
+    struct stat info;
+    if (stat(filename.c_str(), &info) == 0 && static_cast<size_t>(info.st_size) >= header.dataOffset + 2 * kChunkSize)
+    {
+        return loadChunked(filename, header, static_cast<size_t>(info.st_size), cloud);
+    }
+
+    cloud.reserve(header.pointCount, header.hasColor);
+    uint64_t bytes = 0, lines = 0;
+    bool readOk = forEachLine(filename, header.dataOffset, [&](const char *begin, const char *end)
+    {
+        parseRow(begin, end, header.hasColor, cloud);
+        bytes += end - begin + 1;
+        ++lines;
+    });
+    Profiler::count(Profiler::BytesRead, bytes);
+    Profiler::count(Profiler::LinesParsed, lines);
+    Profiler::count(Profiler::PointsKept, cloud.size());
+    return readOk;
+}
+
+bool PointLoader::loadChunked(const std::string &filename, const PointFileHeader &header, size_t fileSize, PointCloud &cloud)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    // Unmapped on every exit, including a BudgetExceeded thrown by a part
+    struct Unmapper
+    {
+        void *mapping;
+        size_t size;
+        ~Unmapper() { munmap(mapping, size); }
+    } unmapper{mapping, fileSize};
+    const char *data = static_cast<const char *>(mapping);
+    const char *dataEnd = data + fileSize;
+
+    // Chunk boundaries sit just after a newline, so no row is split
+    std::vector<const char *> boundaries(1, data + header.dataOffset);
+    while (static_cast<size_t>(dataEnd - boundaries.back()) > kChunkSize)
+    {
+        const char *cut = boundaries.back() + kChunkSize;
+        const char *newline = static_cast<const char *>(std::memchr(cut, '\n', dataEnd - cut));
+        if (newline == nullptr)
+        {
+            break;
+        }
+        boundaries.push_back(newline + 1);
+    }
+    boundaries.push_back(dataEnd);
+
+    // The cloud is sized from the header up front. Chunks are parsed a wave at a time
+    // and each part is freed once appended, so the parts never hold a second copy of the file
+    const size_t chunks = boundaries.size() - 1;
+    const double rowsPerByte = header.pointCount > 0 ? double(header.pointCount) / (dataEnd - boundaries.front()) : 0;
+    const size_t waveSize = ThreadPool::shared().size() + 1;
+    cloud.reserve(header.pointCount, header.hasColor);
+    std::vector<uint64_t> lineCounts(chunks, 0);
+    for (size_t first = 0; first < chunks; first += waveSize)
+    {
+        const size_t wave = std::min(waveSize, chunks - first);
+        std::vector<PointCloud> parts(wave, PointCloud(cloud.account()));
+        ThreadPool::shared().parallelFor(wave, [&](size_t part)
+        {
+            const size_t chunk = first + part;
+            // Rows in proportion to the chunk's bytes, with a margin so the part never grows
+            const size_t rows = static_cast<size_t>(rowsPerByte * (boundaries[chunk + 1] - boundaries[chunk]) * 1.05);
+            parts[part].reserve(rowsPerByte > 0 ? rows + 64 : 0, header.hasColor);
+            const char *lineStart = boundaries[chunk];
+            const char *chunkEnd = boundaries[chunk + 1];
+            while (lineStart < chunkEnd)
+            {
+                const char *newline = static_cast<const char *>(std::memchr(lineStart, '\n', chunkEnd - lineStart));
+                const char *lineEnd = newline != nullptr ? newline : chunkEnd;
+                parseRow(lineStart, lineEnd, header.hasColor, parts[part]);
+                lineStart = lineEnd + 1;
+                ++lineCounts[chunk];
+            }
+        });
+        for (PointCloud &part : parts)
+        {
+            cloud.append(part);
+            part = PointCloud(cloud.account());
+        }
+    }
+    Profiler::count(Profiler::BytesRead, fileSize - header.dataOffset);
+    Profiler::count(Profiler::LinesParsed, std::accumulate(lineCounts.begin(), lineCounts.end(), uint64_t(0)));
+    Profiler::count(Profiler::PointsKept, cloud.size());
+    return true;
+}
+
+void PointLoader::parseRow(const char *begin, const char *end, bool hasColor, PointCloud &cloud)
+{
+    Point point;
+    const char *cursor = parseDouble(begin, end, point.x);
+    cursor = cursor ? parseDouble(cursor, end, point.y) : nullptr;
+    cursor = cursor ? parseDouble(cursor, end, point.z) : nullptr;
+    if (cursor == nullptr)
+    {
+        return;
+    }
+
+    unsigned char rgb[3] = {0, 0, 0};
+    for (int channel = 0; hasColor && channel < 3 && cursor; ++channel)
+    {
+        cursor = parseColorChannel(cursor, end, rgb[channel]);
+    }
+    cloud.add(point, cursor ? PointCloud::packColor(rgb[0], rgb[1], rgb[2]) : 0);
+}
+
+bool PointLoader::readHeader(const std::string &filename, PointFileHeader &header)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // The header is a handful of short lines, one small read covers it
+    char buffer[4096];
+    ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (bytesRead < 0)
+    {
+        return false;
+    }
+
+    header = PointFileHeader();
+    const char *begin = buffer;
+    const char *end = buffer + bytesRead;
+    const char *lineStart = begin;
+    while (lineStart < end)
+    {
+        const char *newline = static_cast<const char *>(std::memchr(lineStart, '\n', end - lineStart));
+        const char *lineEnd = newline != nullptr ? newline : end;
+        std::string line(lineStart, lineEnd);
+        if (!Utils::isHeaderLine(line))
+        {
+            break;
+        }
+
+        int count = 0;
+        if (Utils::checkPointsCount(line, count))
+        {
+            header.pointCount = count;
+        }
+        if (line == "FORMAT x y z r g b")
+        {
+            header.hasColor = true;
+        }
+        header.dataOffset = (newline != nullptr ? newline + 1 : end) - begin;
+        if (Utils::checkData(line))
+        {
+            header.binary = Utils::isBinaryData(line);
+            break;
+        }
+        if (newline == nullptr)
+        {
+            break;
+        }
+        lineStart = newline + 1;
+    }
+    return true;
+}
+
+const char *PointLoader::skipWhitespace(const char *begin, const char *end)
+{
+    while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r' ||
+                           *begin == '\v' || *begin == '\f' || *begin == '\n'))
+    {
+        ++begin;
+    }
+    return begin;
+}
+
+const char *PointLoader::parseDouble(const char *begin, const char *end, double &value)
+{
+    begin = skipWhitespace(begin, end);
+    // operator>> accepts a leading '+', std::from_chars does not
+    if (begin < end && *begin == '+')
+    {
+        ++begin;
+        if (begin < end && *begin == '-')
+        {
+            return nullptr;
+        }
+    }
+    // Reject "inf" and "nan", which operator>> never produced
+    const char *digits = (begin < end && *begin == '-') ? begin + 1 : begin;
+    if (digits == end || !(*digits == '.' || (*digits >= '0' && *digits <= '9')))
+    {
+        return nullptr;
+    }
+
+    std::from_chars_result result = std::from_chars(begin, end, value);
+    if (result.ec != std::errc())
+    {
+        return nullptr;
+    }
+    return result.ptr;
+}
+
+const char *PointLoader::parseColorChannel(const char *begin, const char *end, unsigned char &value)
+{
+    begin = skipWhitespace(begin, end);
+    if (begin < end && *begin == '+')
+    {
+        ++begin;
+    }
+
+    int channel = 0;
+    std::from_chars_result result = std::from_chars(begin, end, channel);
+    if (result.ec != std::errc() || channel < 0 || channel > 255)
+    {
+        return nullptr;
+    }
+    value = static_cast<unsigned char>(channel);
+    return result.ptr;
+}
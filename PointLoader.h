@@ -0,0 +1,174 @@
+#ifndef POINT_LOADER_H
+#define POINT_LOADER_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Point.h"
+#include "PointCloud.h"
+
+/**
+ * @brief What the header lines of a point file say about its data section.
+ */
+struct PointFileHeader
+{
+    int pointCount = 0;    // Value of the POINTS line, 0 if missing
+    bool hasColor = false; // FORMAT x y z r g b
+    bool binary = false;   // DATA binary
+    size_t dataOffset = 0; // Byte offset of the first data row
+};
+
+/**
+ * @brief Shared reader for the data rows of a point file.
+ *
+ * ASCII files are read in large blocks and every row is parsed in place with
+ * std::from_chars, so no per-line strings or streams are created. A row
+ * yields a point when its first three fields are numbers. For the
+ * "x y z r g b" format the colour fields are kept as well. Binary files are
+ * handed to BinaryPointFile.
+ *
+ * Large ascii files are memory-mapped and cut into chunks at row
+ * boundaries; the chunks are parsed concurrently on the shared ThreadPool
+ * and joined in file order, so the result does not change.
+ */
+class PointLoader
+{
+public:
+    /**
+     * @brief Loads every point of a file into @p cloud.
+     *
+     * The POINTS header line, when present, is used to reserve the output
+     * up front. Header lines and rows that do not start with three numbers
+     * are skipped, exactly like the previous getline/istringstream loops.
+     * Rows of an RGB file whose colour does not parse get colour 0.
+     *
+     * @return false if the file could not be opened or read.
+     */
+    static bool loadPoints(const std::string &filename, PointCloud &cloud);
+
+    /**
+     * @brief Reads the leading header lines of a file.
+     *
+     * The header ends at the DATA line or at the first line that is not a
+     * header line, whichever comes first.
+     */
+    static bool readHeader(const std::string &filename, PointFileHeader &header);
+
+    /**
+     * @brief Calls @p handler(begin, end) for every line of the file from @p offset on.
+     *
+     * The line excludes its '\n'. The pointers are only valid during the call.
+     */
+    template <typename LineHandler>
+    static bool forEachLine(const std::string &filename, size_t offset, LineHandler handler);
+
+    /**
+     * @brief Parses one floating point field, skipping leading whitespace.
+     *
+     * @return The position after the number, or nullptr if there is none.
+     */
+    static const char *parseDouble(const char *begin, const char *end, double &value);
+
+    /**
+     * @brief Parses one integer field in [0, 255], skipping leading whitespace.
+     */
+    static const char *parseColorChannel(const char *begin, const char *end, unsigned char &value);
+
+    /**
+     * @brief Appends the point of the row [begin, end) to @p cloud if the row holds one.
+     */
+    static void parseRow(const char *begin, const char *end, bool hasColor, PointCloud &cloud);
+
+private:
+    static const char *skipWhitespace(const char *begin, const char *end);
+    static bool loadChunked(const std::string &filename, const PointFileHeader &header, size_t fileSize, PointCloud &cloud);
+
+    // Data sections at least twice this size are parsed in parallel chunks of this size
+    static const size_t kChunkSize = 8 << 20;
+
+    // Size of a single read() call. Rows are parsed straight out of this buffer.
+    static const size_t kBlockSize = 1 << 20;
+};
+
+template <typename LineHandler>
+bool PointLoader::forEachLine(const std::string &filename, size_t offset, LineHandler handler)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (offset > 0 && lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    // Closes the file even if the handler throws, e.g. BudgetExceeded
+    struct FileCloser
+    {
+        int fd;
+        ~FileCloser() { close(fd); }
+    } closer{fd};
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Let the kernel read ahead aggressively, the file is consumed front to back
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    std::vector<char> buffer(kBlockSize);
+    size_t pending = 0; // Bytes of an unfinished line carried over from the previous block
+    bool readOk = true;
+
+    while (true)
+    {
+        if (pending == buffer.size())
+        {
+            // A single line is larger than the block, grow to fit it
+            buffer.resize(buffer.size() * 2);
+        }
+
+        ssize_t bytesRead = read(fd, buffer.data() + pending, buffer.size() - pending);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            readOk = false;
+            break;
+        }
+
+        const char *begin = buffer.data();
+        const char *end = begin + pending + bytesRead;
+        const char *lineStart = begin;
+        while (lineStart < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(lineStart, '\n', end - lineStart));
+            if (newline == nullptr)
+            {
+                break;
+            }
+            handler(lineStart, newline);
+            lineStart = newline + 1;
+        }
+
+        if (bytesRead == 0)
+        {
+            // Handle the last line if it did not end with a newline
+            if (lineStart < end)
+            {
+                handler(lineStart, end);
+            }
+            break;
+        }
+
+        pending = end - lineStart;
+        std::memmove(buffer.data(), lineStart, pending);
+    }
+
+    return readOk;
+}
+
+#endif // POINT_LOADER_H
@@ -0,0 +1,131 @@
+#include "PointStream.h"
+#include "BinaryPointFile.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+bool PointStream::forEachChunk(const std::string &filename, const ChunkHandler &handler)
+{
+    PointFileHeader header;
+    if (!PointLoader::readHeader(filename, header))
+    {
+        return false;
+    }
+    if (header.binary)
+    {
+        return forEachBinaryChunk(filename, header, handler);
+    }
+
+    // The chunk stays outside the memory budget, streaming is the fallback for files that exceed it
+    PointCloud chunk(std::make_shared<MemoryBudget::Account>(false));
+    chunk.reserve(kChunkPoints, header.hasColor);
+    size_t firstIndex = 0;
+    uint64_t bytes = 0, lines = 0;
+    bool readOk = PointLoader::forEachLine(filename, header.dataOffset, [&](const char *begin, const char *end)
+    {
+        PointLoader::parseRow(begin, end, header.hasColor, chunk);
+        bytes += end - begin + 1;
+        ++lines;
+        if (chunk.size() == kChunkPoints)
+        {
+            handler(chunk, firstIndex);
+            firstIndex += chunk.size();
+            chunk.clear();
+        }
+    });
+    if (readOk && !chunk.empty())
+    {
+        handler(chunk, firstIndex);
+    }
+    Profiler::count(Profiler::BytesRead, bytes);
+    Profiler::count(Profiler::LinesParsed, lines);
+    Profiler::count(Profiler::PointsKept, firstIndex + chunk.size());
+    return readOk;
+}
+
+bool PointStream::forEachBinaryChunk(const std::string &filename, const PointFileHeader &header,
+                                     const ChunkHandler &handler)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !BinaryPointFile::hasExpectedSize(header, static_cast<size_t>(info.st_size)) ||
+        lseek(fd, static_cast<off_t>(header.dataOffset), SEEK_SET) < 0)
+    {
+        close(fd);
+        return false;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    const size_t recordSize = BinaryPointFile::recordSize(header.hasColor);
+    std::vector<unsigned char> buffer(kChunkPoints * recordSize);
+    PointCloud chunk(std::make_shared<MemoryBudget::Account>(false));
+    chunk.reserve(kChunkPoints, header.hasColor);
+    size_t remaining = static_cast<size_t>(header.pointCount);
+    size_t firstIndex = 0;
+    while (remaining > 0)
+    {
+        const size_t count = std::min(remaining, kChunkPoints);
+        const size_t bytes = count * recordSize;
+        size_t filled = 0;
+        while (filled < bytes)
+        {
+            ssize_t bytesRead = read(fd, buffer.data() + filled, bytes - filled);
+            if (bytesRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytesRead <= 0)
+            {
+                close(fd);
+                return false;
+            }
+            filled += bytesRead;
+        }
+
+        chunk.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const unsigned char *record = buffer.data() + i * recordSize;
+            Point point{BinaryPointFile::loadDouble(record), BinaryPointFile::loadDouble(record + 8),
+                        BinaryPointFile::loadDouble(record + 16)};
+            if (header.hasColor)
+            {
+                chunk.add(point, PointCloud::packColor(record[24], record[25], record[26]));
+            }
+            else
+            {
+                chunk.add(point);
+            }
+        }
+        handler(chunk, firstIndex);
+        firstIndex += count;
+        remaining -= count;
+    }
+    close(fd);
+    Profiler::count(Profiler::BytesRead, firstIndex * recordSize);
+    Profiler::count(Profiler::PointsKept, firstIndex);
+    return true;
+}
+
+size_t PointStream::peakResidentBytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss); // Already in bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // Kilobytes on Linux
+#endif
+}
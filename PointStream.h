@@ -0,0 +1,47 @@
+#ifndef POINT_STREAM_H
+#define POINT_STREAM_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include "PointCloud.h"
+#include "PointLoader.h"
+
+/**
+ * @brief Out-of-core reader that hands a point file over in fixed-size chunks.
+ *
+ * Only one chunk of kChunkPoints points and one read block are held at a
+ * time, so memory stays bounded whatever the size of the file. Neither is
+ * charged to the MemoryBudget, so files refused by the budget can still be
+ * streamed once it is exhausted. Ascii rows
+ * are parsed with PointLoader, binary records are read with plain read()
+ * calls; both hint the kernel that the file is read sequentially.
+ */
+class PointStream
+{
+public:
+    typedef std::function<void(const PointCloud &chunk, size_t firstIndex)> ChunkHandler;
+
+    static constexpr size_t kChunkPoints = 1 << 16;
+
+    /**
+     * @brief Calls @p handler for consecutive chunks of the points of @p filename.
+     *
+     * @p firstIndex is the position in the file of the first point of the
+     * chunk. The chunk is reused after the call returns.
+     *
+     * @return false if the file could not be opened or read.
+     */
+    static bool forEachChunk(const std::string &filename, const ChunkHandler &handler);
+
+    /**
+     * @brief Peak resident set size of the process so far, in bytes.
+     */
+    static size_t peakResidentBytes();
+
+private:
+    static bool forEachBinaryChunk(const std::string &filename, const PointFileHeader &header,
+                                   const ChunkHandler &handler);
+};
+
+#endif // POINT_STREAM_H
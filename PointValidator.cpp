@@ -0,0 +1,251 @@
+#include "PointValidator.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    bool isSeparator(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    const char *skipSeparators(const char *begin, const char *end)
+    {
+        while (begin < end && isSeparator(*begin))
+        {
+            ++begin;
+        }
+        return begin;
+    }
+
+    // Calls handler(newline) for every '\n' in [begin, end), in order
+    template <typename Handler>
+    void forEachNewline(const char *begin, const char *end, Handler handler)
+    {
+        const char *cursor = begin;
+#if defined(__SSE2__)
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; cursor + 16 <= end; cursor += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cursor));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+            while (mask != 0)
+            {
+                handler(cursor + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; cursor < end; ++cursor)
+        {
+            if (*cursor == '\n')
+            {
+                handler(cursor);
+            }
+        }
+    }
+
+    // Results of one chunk, with line numbers relative to the chunk's first line
+    struct ChunkReport
+    {
+        size_t lineCount = 0;
+        ValidationReport report;
+    };
+
+    void checkLine(const char *begin, const char *end, bool hasColor, size_t line, size_t maxErrors, ChunkReport &chunk)
+    {
+        if (skipSeparators(begin, end) == end)
+        {
+            return;
+        }
+        ++chunk.report.rowCount;
+
+        ValidationError error;
+        if (!PointValidator::checkRow(begin, end, hasColor, error.column, error.message))
+        {
+            if (chunk.report.errors.size() < maxErrors)
+            {
+                error.line = line;
+                chunk.report.errors.push_back(error);
+            }
+            ++chunk.report.errorCount;
+        }
+    }
+}
+
+bool PointValidator::checkRow(const char *begin, const char *end, bool hasColor, size_t &column, std::string &message)
+{
+    const int fieldCount = hasColor ? 6 : 3;
+    const char *cursor = begin;
+    for (int field = 0; field < fieldCount; ++field)
+    {
+        const char *start = skipSeparators(cursor, end);
+        column = start - begin + 1;
+        if (start == end)
+        {
+            message = "Expected " + std::to_string(fieldCount) + " fields, found " + std::to_string(field) + ".";
+            return false;
+        }
+
+        const char *next = nullptr;
+        if (field < 3)
+        {
+            double value;
+            next = PointLoader::parseDouble(start, end, value);
+            if (next == nullptr || (next < end && !isSeparator(*next)))
+            {
+                message = "Invalid number.";
+                return false;
+            }
+        }
+        else
+        {
+            int channel = 0;
+            const char *digits = (*start == '+') ? start + 1 : start;
+            std::from_chars_result result = std::from_chars(digits, end, channel);
+            if (result.ec == std::errc::result_out_of_range ||
+                (result.ec == std::errc() && (channel < 0 || channel > 255)))
+            {
+                message = "Colour value must be between 0 and 255.";
+                return false;
+            }
+            if (result.ec != std::errc() || (result.ptr < end && !isSeparator(*result.ptr)))
+            {
+                message = "Invalid colour value.";
+                return false;
+            }
+            next = result.ptr;
+        }
+        cursor = next;
+    }
+
+    const char *rest = skipSeparators(cursor, end);
+    if (rest < end)
+    {
+        column = rest - begin + 1;
+        message = "Expected " + std::to_string(fieldCount) + " fields, found more.";
+        return false;
+    }
+    return true;
+}
+
+size_t PointValidator::countNewlines(const char *begin, const char *end)
+{
+    size_t count = 0;
+    forEachNewline(begin, end, [&count](const char *) { ++count; });
+    return count;
+}
+
+bool PointValidator::validateRows(const std::string &filename, const PointFileHeader &header, ValidationReport &report,
+                                  size_t maxErrors)
+{
+    report = ValidationReport();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    const size_t fileSize = static_cast<size_t>(info.st_size);
+    if (fileSize <= header.dataOffset)
+    {
+        close(fd);
+        return true;
+    }
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    const char *data = static_cast<const char *>(mapping);
+    const size_t headerLines = countNewlines(data, data + header.dataOffset);
+
+    // Leave out a trailing ">" end marker line
+    const char *dataBegin = data + header.dataOffset;
+    const char *dataEnd = data + fileSize;
+    const char *contentEnd = dataEnd;
+    while (contentEnd > dataBegin && (isSeparator(contentEnd[-1]) || contentEnd[-1] == '\n'))
+    {
+        --contentEnd;
+    }
+    const char *lastLine = contentEnd;
+    while (lastLine > dataBegin && lastLine[-1] != '\n')
+    {
+        --lastLine;
+    }
+    if (contentEnd - lastLine == 1 && *lastLine == '>')
+    {
+        dataEnd = lastLine;
+    }
+
+    // Chunk boundaries sit just after a newline, so no row is split
+    std::vector<const char *> boundaries(1, dataBegin);
+    while (static_cast<size_t>(dataEnd - boundaries.back()) > kChunkSize)
+    {
+        const char *cut = boundaries.back() + kChunkSize;
+        const char *newline = static_cast<const char *>(std::memchr(cut, '\n', dataEnd - cut));
+        if (newline == nullptr)
+        {
+            break;
+        }
+        boundaries.push_back(newline + 1);
+    }
+    boundaries.push_back(dataEnd);
+
+    const size_t chunks = boundaries.size() - 1;
+    std::vector<ChunkReport> chunkReports(chunks);
+    ThreadPool::shared().parallelFor(chunks, [&](size_t index)
+    {
+        ChunkReport &chunk = chunkReports[index];
+        const char *lineStart = boundaries[index];
+        const char *chunkEnd = boundaries[index + 1];
+        forEachNewline(lineStart, chunkEnd, [&](const char *newline)
+        {
+            checkLine(lineStart, newline, header.hasColor, chunk.lineCount, maxErrors, chunk);
+            ++chunk.lineCount;
+            lineStart = newline + 1;
+        });
+        if (lineStart < chunkEnd)
+        {
+            // Last line without a newline
+            checkLine(lineStart, chunkEnd, header.hasColor, chunk.lineCount, maxErrors, chunk);
+        }
+    });
+    munmap(mapping, fileSize);
+    Profiler::count(Profiler::BytesRead, dataEnd - dataBegin);
+
+    // Turn chunk-relative line numbers into file line numbers, keeping the first errors
+    size_t firstLine = headerLines + 1;
+    for (const ChunkReport &chunk : chunkReports)
+    {
+        report.rowCount += chunk.report.rowCount;
+        report.errorCount += chunk.report.errorCount;
+        for (const ValidationError &error : chunk.report.errors)
+        {
+            if (report.errors.size() < maxErrors)
+            {
+                report.errors.push_back(error);
+                report.errors.back().line += firstLine;
+            }
+        }
+        firstLine += chunk.lineCount;
+    }
+    Profiler::count(Profiler::LinesParsed, firstLine - headerLines - 1);
+    return true;
+}
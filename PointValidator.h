@@ -0,0 +1,73 @@
+#ifndef POINT_VALIDATOR_H
+#define POINT_VALIDATOR_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "PointLoader.h"
+
+/**
+ * @brief One problem found in the data section, with its 1-based position in the file.
+ */
+struct ValidationError
+{
+    size_t line = 0;
+    size_t column = 0;
+    std::string message;
+};
+
+/**
+ * @brief Outcome of checking every data row of a point file.
+ */
+struct ValidationReport
+{
+    size_t rowCount = 0;                 // Non-blank data rows, valid or not
+    size_t errorCount = 0;               // Every error, including those not kept below
+    std::vector<ValidationError> errors; // The first errors in file order
+
+    bool valid() const { return errorCount == 0; }
+};
+
+/**
+ * @brief Checks the data rows of an ascii point file against its FORMAT line.
+ *
+ * Every row must hold exactly three numbers for "x y z", or three numbers
+ * and three integers in [0, 255] for "x y z r g b". Blank lines are ignored
+ * and a lone ">" as the last line is accepted as an end marker.
+ *
+ * The file is memory-mapped and cut into chunks at row boundaries. Line
+ * ends are found 16 bytes at a time with SSE2 and every chunk is checked
+ * on the shared ThreadPool, so large files validate at close to the speed
+ * they can be read.
+ */
+class PointValidator
+{
+public:
+    static constexpr size_t kMaxReportedErrors = 10;
+
+    /**
+     * @brief Checks every row of the data section that starts at header.dataOffset.
+     *
+     * @return false if the file could not be opened or read.
+     */
+    static bool validateRows(const std::string &filename, const PointFileHeader &header, ValidationReport &report,
+                             size_t maxErrors = kMaxReportedErrors);
+
+    /**
+     * @brief Checks one row [begin, end), without its newline.
+     *
+     * @return false with the 1-based @p column and a @p message if the row is invalid.
+     */
+    static bool checkRow(const char *begin, const char *end, bool hasColor, size_t &column, std::string &message);
+
+    /**
+     * @brief Number of '\n' bytes in [begin, end).
+     */
+    static size_t countNewlines(const char *begin, const char *end);
+
+private:
+    // Data sections are split into chunks of about this size
+    static constexpr size_t kChunkSize = 8 << 20;
+};
+
+#endif // POINT_VALIDATOR_H
@@ -0,0 +1,398 @@
+#include "PointWatcher.h"
+#include "BinaryPointFile.h"
+#include "FullAnalysis.h"
+#include "Profiler.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <limits>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace
+{
+    // The tie rules of PairSearch: equal distances go to the pair with the smallest (first, second)
+    bool precedes(size_t a, size_t b, const PointPair &pair)
+    {
+        return a < pair.first || (a == pair.first && b < pair.second);
+    }
+
+    void offerClosest(PointPair &best, size_t a, size_t b, double distanceSquared)
+    {
+        if (!best.found || distanceSquared < best.distanceSquared ||
+            (distanceSquared == best.distanceSquared && precedes(a, b, best)))
+        {
+            best.first = a;
+            best.second = b;
+            best.distanceSquared = distanceSquared;
+            best.found = true;
+        }
+    }
+
+    void offerFarthest(PointPair &best, size_t a, size_t b, double distanceSquared)
+    {
+        if (!best.found || distanceSquared > best.distanceSquared ||
+            (distanceSquared == best.distanceSquared && precedes(a, b, best)))
+        {
+            best.first = a;
+            best.second = b;
+            best.distanceSquared = distanceSquared;
+            best.found = true;
+        }
+    }
+
+    double secondsSince(const std::chrono::steady_clock::time_point &start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+Point PointWatcher::FileState::centroid() const
+{
+    const size_t n = cloud ? cloud->size() : 0;
+    return n > 0 ? Point{sum[0] / n, sum[1] / n, sum[2] / n} : Point{0, 0, 0};
+}
+
+PointWatcher::PointWatcher(const std::string &directory)
+    : directory_(directory)
+{
+    stopping_ = false;
+#ifdef __linux__
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_ >= 0 &&
+        inotify_add_watch(inotify_, directory_.c_str(),
+                          IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0)
+    {
+        // No inotify for this directory (e.g. a network mount), fall back to polling
+        close(inotify_);
+        inotify_ = -1;
+    }
+#endif
+}
+
+PointWatcher::~PointWatcher()
+{
+    if (inotify_ >= 0)
+    {
+        close(inotify_);
+    }
+}
+
+void PointWatcher::loadAll(const UpdateHandler &handler)
+{
+    for (const std::string &filename : listPointFiles())
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t appended = 0;
+        if (refresh(filename, appended))
+        {
+            handler(files_.at(filename).state, appended, secondsSince(start));
+        }
+    }
+}
+
+bool PointWatcher::run(const UpdateHandler &handler)
+{
+    std::vector<char> events(64 * 1024);
+    while (!stopping_)
+    {
+        std::vector<std::string> changed;
+        if (inotify_ >= 0)
+        {
+            pollfd ready = {inotify_, POLLIN, 0};
+            int count = poll(&ready, 1, kPollMilliseconds);
+            if (count < 0 && errno != EINTR)
+            {
+                return false;
+            }
+            if (count <= 0)
+            {
+                continue;
+            }
+#ifdef __linux__
+            // Drain every queued event; a burst of writes to one file becomes one refresh
+            ssize_t bytes;
+            while ((bytes = read(inotify_, events.data(), events.size())) > 0)
+            {
+                for (ssize_t offset = 0; offset < bytes;)
+                {
+                    const inotify_event *event = reinterpret_cast<const inotify_event *>(events.data() + offset);
+                    if (event->len > 0)
+                    {
+                        std::string filename = directory_ + "/" + event->name;
+                        if (std::find(changed.begin(), changed.end(), filename) == changed.end())
+                        {
+                            changed.push_back(filename);
+                        }
+                    }
+                    offset += sizeof(inotify_event) + event->len;
+                }
+            }
+#endif
+        }
+        else
+        {
+            // Polling: refresh() only reads files whose size or inode changed
+            usleep(kPollMilliseconds * 1000);
+            changed = listPointFiles();
+            for (const auto &tracked : files_)
+            {
+                if (std::find(changed.begin(), changed.end(), tracked.first) == changed.end())
+                {
+                    changed.push_back(tracked.first);
+                }
+            }
+        }
+
+        for (const std::string &filename : changed)
+        {
+            if (!Utils::checkFileExtension(filename))
+            {
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            size_t appended = 0;
+            if (refresh(filename, appended) && appended > 0)
+            {
+                handler(files_.at(filename).state, appended, secondsSince(start));
+            }
+        }
+    }
+    return true;
+}
+
+bool PointWatcher::refresh(const std::string &filename, size_t &appended)
+{
+    appended = 0;
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        files_.erase(filename);
+        return false;
+    }
+
+    auto found = files_.find(filename);
+    const size_t fileSize = static_cast<size_t>(info.st_size);
+    if (found != files_.end() && (found->second.inode != info.st_ino || fileSize < found->second.parsedBytes))
+    {
+        // Replaced or truncated, start over
+        files_.erase(found);
+        found = files_.end();
+    }
+    if (found == files_.end())
+    {
+        Tracked tracked;
+        if (!PointLoader::readHeader(filename, tracked.header) || tracked.header.dataOffset == 0)
+        {
+            return false;
+        }
+        tracked.inode = info.st_ino;
+        tracked.parsedBytes = tracked.header.dataOffset;
+        tracked.state.filename = filename;
+        tracked.state.cloud = std::make_shared<PointCloud>();
+        tracked.state.cloud->reserve(0, tracked.header.hasColor);
+        tracked.state.low = Point{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+        tracked.state.high = Point{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+        found = files_.emplace(filename, std::move(tracked)).first;
+    }
+    Tracked &tracked = found->second;
+    if (fileSize == tracked.parsedBytes)
+    {
+        return true;
+    }
+
+    Profiler::Scope scope(filename, "watch_update");
+    PointCloud added;
+    added.reserve(0, tracked.header.hasColor);
+    if (!readAppended(tracked, fileSize, added))
+    {
+        files_.erase(found);
+        return false;
+    }
+    if (added.empty())
+    {
+        return true;
+    }
+
+    PointCloud &cloud = *tracked.state.cloud;
+    const size_t firstNew = cloud.size();
+    if (tracked.tree && firstNew - tracked.indexedCount > kIncrementalLimit)
+    {
+        // Too many points wait outside the tree; index the cloud as it is before the append
+        tracked.tree.reset(new KDTree(tracked.state.cloud));
+        tracked.indexedCount = firstNew;
+    }
+    cloud.append(added);
+    appended = added.size();
+
+    Point low, high;
+    double sum[3];
+    FullAnalysis::summarize(cloud, firstNew, cloud.size(), low, high, sum);
+    FileState &state = tracked.state;
+    state.low = Point{std::min(state.low.x, low.x), std::min(state.low.y, low.y), std::min(state.low.z, low.z)};
+    state.high = Point{std::max(state.high.x, high.x), std::max(state.high.y, high.y), std::max(state.high.z, high.z)};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        state.sum[axis] += sum[axis];
+    }
+
+    AverageDistance::Result average = AverageDistance::computeAppended(cloud, firstNew);
+    state.average.totalDistance += average.totalDistance;
+    state.average.pairCount += average.pairCount;
+
+    updatePairs(tracked, firstNew);
+    return true;
+}
+
+const PointWatcher::FileState *PointWatcher::state(const std::string &filename) const
+{
+    auto found = files_.find(filename);
+    return found != files_.end() ? &found->second.state : nullptr;
+}
+
+bool PointWatcher::readAppended(Tracked &tracked, size_t fileSize, PointCloud &added)
+{
+    int fd = open(tracked.state.filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    const bool hasColor = tracked.header.hasColor;
+    const size_t recordSize = BinaryPointFile::recordSize(hasColor);
+    std::vector<char> buffer(1 << 20);
+    size_t offset = tracked.parsedBytes;
+    size_t pending = 0; // Bytes of an unfinished row carried over from the previous block
+    bool readOk = true;
+    uint64_t lines = 0;
+    while (offset + pending < fileSize)
+    {
+        if (pending == buffer.size())
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+        size_t wanted = std::min(buffer.size() - pending, fileSize - offset - pending);
+        ssize_t bytesRead = pread(fd, buffer.data() + pending, wanted, static_cast<off_t>(offset + pending));
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            // An error, or the file shrank while it was read
+            readOk = bytesRead == 0;
+            break;
+        }
+
+        // Only complete rows or records are consumed, the rest is read again next time
+        const char *begin = buffer.data();
+        const char *end = begin + pending + bytesRead;
+        const char *rowStart = begin;
+        if (tracked.header.binary)
+        {
+            for (; static_cast<size_t>(end - rowStart) >= recordSize; rowStart += recordSize)
+            {
+                const unsigned char *record = reinterpret_cast<const unsigned char *>(rowStart);
+                Point point{BinaryPointFile::loadDouble(record), BinaryPointFile::loadDouble(record + 8),
+                            BinaryPointFile::loadDouble(record + 16)};
+                added.add(point, hasColor ? PointCloud::packColor(record[24], record[25], record[26]) : 0);
+            }
+        }
+        else
+        {
+            const char *newline;
+            while ((newline = static_cast<const char *>(std::memchr(rowStart, '\n', end - rowStart))) != nullptr)
+            {
+                PointLoader::parseRow(rowStart, newline, hasColor, added);
+                rowStart = newline + 1;
+                ++lines;
+            }
+        }
+        offset += rowStart - begin;
+        pending = end - rowStart;
+        std::memmove(buffer.data(), rowStart, pending);
+    }
+    close(fd);
+
+    Profiler::count(Profiler::BytesRead, offset - tracked.parsedBytes);
+    Profiler::count(Profiler::LinesParsed, lines);
+    Profiler::count(Profiler::PointsKept, added.size());
+    tracked.parsedBytes = offset;
+    return readOk;
+}
+
+void PointWatcher::updatePairs(Tracked &tracked, size_t firstNew)
+{
+    FileState &state = tracked.state;
+    const PointCloud &cloud = *state.cloud;
+    const size_t n = cloud.size();
+    if (firstNew < kIncrementalLimit || n - firstNew > kIncrementalLimit || !tracked.tree)
+    {
+        // Small clouds and large appends: search from scratch and index the whole cloud
+        state.closest = PairSearch::closestPair(cloud);
+        state.farthest = PairSearch::farthestPair(cloud);
+        tracked.tree.reset(n >= kIncrementalLimit ? new KDTree(state.cloud) : nullptr);
+        tracked.indexedCount = tracked.tree ? n : 0;
+        return;
+    }
+
+    // Pairs with a new point j: the tree covers [0, indexedCount), brute force covers [indexedCount, j)
+    const size_t indexed = tracked.indexedCount;
+    const double *xs = cloud.xData();
+    const double *ys = cloud.yData();
+    const double *zs = cloud.zData();
+    uint64_t evaluations = 0;
+    for (size_t j = firstNew; j < n; ++j)
+    {
+        const Point point{xs[j], ys[j], zs[j]};
+        std::vector<std::pair<double, size_t>> nearest = tracked.tree->nearest(point, 1);
+        if (!nearest.empty())
+        {
+            offerClosest(state.closest, nearest[0].second, j, nearest[0].first);
+        }
+        std::pair<double, size_t> farthest = tracked.tree->farthest(point);
+        if (farthest.second < indexed)
+        {
+            offerFarthest(state.farthest, farthest.second, j, farthest.first);
+        }
+        for (size_t i = indexed; i < j; ++i)
+        {
+            double dx = xs[i] - xs[j];
+            double dy = ys[i] - ys[j];
+            double dz = zs[i] - zs[j];
+            double distanceSquared = dx * dx + dy * dy + dz * dz;
+            offerClosest(state.closest, i, j, distanceSquared);
+            offerFarthest(state.farthest, i, j, distanceSquared);
+        }
+        evaluations += j - indexed;
+    }
+    Profiler::count(Profiler::DistanceEvaluations, evaluations);
+}
+
+std::vector<std::string> PointWatcher::listPointFiles() const
+{
+    std::vector<std::string> filenames;
+    DIR *directory = opendir(directory_.c_str());
+    if (directory == nullptr)
+    {
+        return filenames;
+    }
+    while (dirent *entry = readdir(directory))
+    {
+        std::string name = entry->d_name;
+        if (Utils::checkFileExtension(name))
+        {
+            filenames.push_back(directory_ + "/" + name);
+        }
+    }
+    closedir(directory);
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
@@ -0,0 +1,116 @@
+#ifndef POINT_WATCHER_H
+#define POINT_WATCHER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include "AverageDistance.h"
+#include "KDTree.h"
+#include "PairSearch.h"
+#include "PointCloud.h"
+#include "PointLoader.h"
+
+/**
+ * @brief Keeps the analyses of the point files in a directory current while they grow.
+ *
+ * Every .pt file is parsed once and its state kept in memory: the points,
+ * the bounding box, the coordinate sums for the centroid, the closest and
+ * farthest pairs and the running sum of all pairwise distances. When a file
+ * grows only the rows after the last parsed byte are read (an unfinished
+ * last row waits for the next change), and the state is updated from the
+ * appended points alone:
+ *
+ * - bounds and sums are extended with the new points,
+ * - the distance sum gains the pairs that include a new point,
+ * - each new point is matched against a KD-tree of the earlier points for
+ *   its nearest and farthest partner, and by brute force against the few
+ *   points added since the tree was built.
+ *
+ * Bounds and pairs are exactly those of a full recomputation, the average
+ * distance differs only by rounding. A file that shrinks or is replaced is
+ * loaded again from scratch. Changes are noticed with inotify on Linux,
+ * otherwise the directory is polled. The POINTS line is ignored, since
+ * appending rows leaves it stale.
+ */
+class PointWatcher
+{
+public:
+    struct FileState
+    {
+        std::string filename;
+        std::shared_ptr<PointCloud> cloud;
+        Point low, high;
+        double sum[3] = {0, 0, 0};
+        PointPair closest, farthest;
+        AverageDistance::Result average;
+
+        Point centroid() const;
+    };
+
+    /**
+     * @brief Called after a file was loaded or grew by @p appended points in @p seconds.
+     */
+    typedef std::function<void(const FileState &state, size_t appended, double seconds)> UpdateHandler;
+
+    explicit PointWatcher(const std::string &directory);
+    ~PointWatcher();
+    PointWatcher(const PointWatcher &) = delete;
+    PointWatcher &operator=(const PointWatcher &) = delete;
+
+    /**
+     * @brief Loads every point file of the directory, calling @p handler for each in name order.
+     */
+    void loadAll(const UpdateHandler &handler);
+
+    /**
+     * @brief Waits for changes and calls @p handler for every file that grew, until stop() is called.
+     *
+     * @return false if the directory cannot be read.
+     */
+    bool run(const UpdateHandler &handler);
+
+    /**
+     * @brief Makes run() return; safe to call from a signal handler.
+     */
+    static void stop() { stopping_ = true; }
+
+    /**
+     * @brief Reads the rows added to @p filename since the last call and updates its state.
+     *
+     * @return false if the file has no usable header or cannot be read;
+     *         its state is dropped then.
+     */
+    bool refresh(const std::string &filename, size_t &appended);
+
+    const FileState *state(const std::string &filename) const;
+
+private:
+    struct Tracked
+    {
+        FileState state;
+        PointFileHeader header;
+        ino_t inode = 0;
+        size_t parsedBytes = 0;             // Data consumed so far, always at a row boundary
+        std::unique_ptr<const KDTree> tree; // Over the first indexedCount points
+        size_t indexedCount = 0;
+    };
+
+    bool readAppended(Tracked &tracked, size_t fileSize, PointCloud &added);
+    void updatePairs(Tracked &tracked, size_t firstNew);
+    std::vector<std::string> listPointFiles() const;
+
+    // Appends of more points than this, or to smaller clouds, recompute the pairs from scratch
+    static const size_t kIncrementalLimit = 4096;
+    // Milliseconds between checks when polling, and the longest inotify wait between stop() checks
+    static const int kPollMilliseconds = 250;
+
+    std::string directory_;
+    std::map<std::string, Tracked> files_;
+    int inotify_ = -1;
+    static inline std::atomic<bool> stopping_{false};
+};
+
+#endif // POINT_WATCHER_H
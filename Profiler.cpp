@@ -0,0 +1,159 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <iomanip>
+
+namespace
+{
+    // Innermost active scope of this thread
+    thread_local Profiler::Scope *tlsCurrentScope = nullptr;
+
+    const char *const kCounterNames[Profiler::kCounterCount] = {
+        "bytes_read", "lines_parsed", "points_kept", "distance_evaluations", "query_hits", "peak_bytes"};
+
+    void merge(uint64_t &total, Profiler::Counter counter, uint64_t amount)
+    {
+        total = counter == Profiler::PeakBytes ? std::max(total, amount) : total + amount;
+    }
+
+    std::string escapeJson(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+}
+
+Profiler::Scope::Scope(const std::string &file, const char *phase)
+    : active_(Profiler::enabled()), phase_(phase)
+{
+    if (!active_)
+    {
+        return;
+    }
+    file_ = file;
+    parent_ = tlsCurrentScope;
+    tlsCurrentScope = this;
+    start_ = std::chrono::steady_clock::now();
+}
+
+Profiler::Scope::~Scope()
+{
+    if (!active_)
+    {
+        return;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    tlsCurrentScope = parent_;
+    Profiler::record(file_, phase_, seconds, 1, counters_);
+}
+
+void Profiler::addCount(Counter counter, uint64_t amount)
+{
+    if (tlsCurrentScope != nullptr)
+    {
+        merge(tlsCurrentScope->counters_[counter], counter, amount);
+        return;
+    }
+    uint64_t counters[kCounterCount] = {};
+    counters[counter] = amount;
+    record("", "other", 0, 0, counters);
+}
+
+void Profiler::record(const std::string &file, const char *phase, double seconds, uint64_t calls,
+                      const uint64_t counters[kCounterCount])
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Record *target = nullptr;
+    for (Record &existing : records_)
+    {
+        if (existing.file == file && existing.phase == phase)
+        {
+            target = &existing;
+            break;
+        }
+    }
+    if (target == nullptr)
+    {
+        records_.emplace_back();
+        target = &records_.back();
+        target->file = file;
+        target->phase = phase;
+    }
+    target->calls += calls;
+    target->seconds += seconds;
+    for (int counter = 0; counter < kCounterCount; ++counter)
+    {
+        merge(target->counters[counter], Counter(counter), counters[counter]);
+    }
+}
+
+std::vector<Profiler::Record> Profiler::snapshot()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_;
+}
+
+void Profiler::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.clear();
+}
+
+void Profiler::printTable(std::ostream &out)
+{
+    std::vector<Record> records = snapshot();
+    if (records.empty())
+    {
+        return;
+    }
+
+    size_t fileWidth = 4;
+    for (const Record &record : records)
+    {
+        fileWidth = std::max(fileWidth, record.file.size());
+    }
+    out << "Profile:\n" << std::left << std::setw(fileWidth + 2) << "File" << std::setw(18) << "Phase" << std::right
+        << std::setw(7) << "Calls" << std::setw(12) << "Seconds" << std::setw(14) << "Bytes" << std::setw(12) << "Lines"
+        << std::setw(12) << "Points" << std::setw(16) << "Distances" << std::setw(12) << "Hits" << std::setw(10) << "Peak MiB"
+        << std::setw(10) << "MB/s"
+        << "\n";
+    for (const Record &record : records)
+    {
+        double megabytesPerSecond = record.seconds > 0 ? record.counters[BytesRead] / record.seconds / (1 << 20) : 0;
+        out << std::left << std::setw(fileWidth + 2) << record.file << std::setw(18) << record.phase << std::right
+            << std::setw(7) << record.calls << std::setw(12) << std::fixed << std::setprecision(6) << record.seconds
+            << std::setw(14) << record.counters[BytesRead] << std::setw(12) << record.counters[LinesParsed]
+            << std::setw(12) << record.counters[PointsKept] << std::setw(16) << record.counters[DistanceEvaluations]
+            << std::setw(12) << record.counters[QueryHits] << std::setw(10) << std::setprecision(1)
+            << record.counters[PeakBytes] / double(1 << 20) << std::setw(10) << megabytesPerSecond
+            << "\n";
+    }
+    out.unsetf(std::ios_base::fixed);
+    out.precision(6);
+    out.flush();
+}
+
+void Profiler::printJson(std::ostream &out)
+{
+    std::vector<Record> records = snapshot();
+    out << "[";
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const Record &record = records[i];
+        out << (i == 0 ? "\n" : ",\n") << "  {\"file\": \"" << escapeJson(record.file) << "\", \"phase\": \""
+            << escapeJson(record.phase) << "\", \"calls\": " << record.calls << ", \"seconds\": " << record.seconds;
+        for (int counter = 0; counter < kCounterCount; ++counter)
+        {
+            out << ", \"" << kCounterNames[counter] << "\": " << record.counters[counter];
+        }
+        out << "}";
+    }
+    out << "\n]" << std::endl;
+}
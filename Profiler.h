@@ -0,0 +1,99 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Optional per-file, per-phase timers and counters.
+ *
+ * A Scope times one phase of one file on the current thread and collects
+ * the counters added while it is the innermost scope of that thread. Scopes
+ * nest, and the time of an outer scope includes that of inner ones. When
+ * profiling is off a Scope only reads one atomic flag and count() returns
+ * right away, so the hooks can stay in the hot paths.
+ *
+ * Counters are added once per call with the totals of that call, never per
+ * point, so work done on pool threads is counted by the thread that waited
+ * for it. PeakBytes keeps the largest amount counted instead of the sum.
+ */
+class Profiler
+{
+public:
+    enum Counter
+    {
+        BytesRead,
+        LinesParsed,
+        PointsKept,
+        DistanceEvaluations,
+        QueryHits,
+        PeakBytes, // Largest value counted, not a sum
+        kCounterCount
+    };
+
+    class Scope
+    {
+    public:
+        Scope(const std::string &file, const char *phase);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        friend class Profiler;
+
+        bool active_;
+        std::string file_;
+        const char *phase_;
+        std::chrono::steady_clock::time_point start_;
+        uint64_t counters_[kCounterCount] = {};
+        Scope *parent_ = nullptr;
+    };
+
+    static void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Adds @p amount to a counter of the innermost scope of this thread.
+     */
+    static void count(Counter counter, uint64_t amount)
+    {
+        if (enabled())
+        {
+            addCount(counter, amount);
+        }
+    }
+
+    /**
+     * @brief Prints one row per file and phase, in the order they were first recorded.
+     */
+    static void printTable(std::ostream &out);
+    static void printJson(std::ostream &out);
+    static void reset();
+
+private:
+    struct Record
+    {
+        std::string file;
+        std::string phase;
+        uint64_t calls = 0;
+        double seconds = 0;
+        uint64_t counters[kCounterCount] = {};
+    };
+
+    static void addCount(Counter counter, uint64_t amount);
+    static void record(const std::string &file, const char *phase, double seconds, uint64_t calls,
+                       const uint64_t counters[kCounterCount]);
+    static std::vector<Record> snapshot();
+
+    static inline std::atomic<bool> enabled_{false};
+    static inline std::mutex mutex_;
+    static inline std::vector<Record> records_;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,284 @@
+#include "QueryServer.h"
+#include "BatchQuery.h"
+#include "FullAnalysis.h"
+#include "Profiler.h"
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <list>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+void QueryServer::add(const std::string &filename, std::shared_ptr<const KDTree> index)
+{
+    ServedFile file;
+    file.filename = filename;
+    const PointCloud &cloud = index->cloud();
+    double sum[3] = {0, 0, 0};
+    if (!cloud.empty())
+    {
+        FullAnalysis::summarize(cloud, 0, cloud.size(), file.low, file.high, sum);
+        file.centroid = Point{sum[0] / cloud.size(), sum[1] / cloud.size(), sum[2] / cloud.size()};
+    }
+    file.index = std::move(index);
+    files_.push_back(std::move(file));
+}
+
+QueryServer::~QueryServer()
+{
+    if (listener_ >= 0)
+    {
+        close(listener_);
+        unlink(socketPath_.c_str());
+    }
+}
+
+bool QueryServer::listen(const std::string &socketPath, std::ostream &errors)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    {
+        errors << "Error: Invalid socket path: " << socketPath << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // Only a socket left behind by an earlier run is removed
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            errors << "Error: " << socketPath << " exists and is not a socket." << std::endl;
+            return false;
+        }
+        unlink(socketPath.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0)
+    {
+        errors << "Error: Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        return false;
+    }
+    listener_ = listener;
+    socketPath_ = socketPath;
+    return true;
+}
+
+void QueryServer::run()
+{
+    // Finished client threads are joined as new clients arrive, the rest when stopping
+    struct Client
+    {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::list<Client> clients;
+    while (!stopping_)
+    {
+        for (auto client = clients.begin(); client != clients.end();)
+        {
+            if (*client->done)
+            {
+                client->thread.join();
+                client = clients.erase(client);
+            }
+            else
+            {
+                ++client;
+            }
+        }
+
+        pollfd ready = {listener_, POLLIN, 0};
+        if (poll(&ready, 1, kPollMilliseconds) <= 0)
+        {
+            continue;
+        }
+        int connection = accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            continue;
+        }
+        std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+        clients.push_back(Client{std::thread([this, connection, done]
+        {
+            serveClient(connection);
+            close(connection);
+            *done = true;
+        }), done});
+    }
+
+    for (Client &client : clients)
+    {
+        client.thread.join();
+    }
+    close(listener_);
+    unlink(socketPath_.c_str());
+    listener_ = -1;
+}
+
+std::string QueryServer::respond(const std::string &request) const
+{
+    std::istringstream iss(request);
+    std::string command, name;
+    iss >> command;
+    if (command == "quit")
+    {
+        return std::string();
+    }
+
+    std::ostringstream out;
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    if (command == "files")
+    {
+        out << "OK " << files_.size() << "\n";
+        for (const ServedFile &file : files_)
+        {
+            out << file.filename << " " << file.index->cloud().size() << "\n";
+        }
+        return out.str();
+    }
+
+    if (!(iss >> name))
+    {
+        return error(command.empty() ? "Empty request." : "Missing file name.");
+    }
+    const ServedFile *file = find(name);
+    if (file == nullptr)
+    {
+        return error("Unknown file: " + name);
+    }
+    if (command == "stats")
+    {
+        out << "OK 4\n"
+            << "points " << file->index->cloud().size() << "\n"
+            << "min " << file->low.x << " " << file->low.y << " " << file->low.z << "\n"
+            << "max " << file->high.x << " " << file->high.y << " " << file->high.z << "\n"
+            << "centroid " << file->centroid.x << " " << file->centroid.y << " " << file->centroid.z << "\n";
+        return out.str();
+    }
+
+    // The rest of the line is a query in the query file syntax
+    std::string arguments;
+    getline(iss, arguments);
+    BatchQuery::Query query;
+    if (!BatchQuery::parseQuery(command + arguments, query))
+    {
+        return error("Invalid request: " + request);
+    }
+    std::vector<BatchQuery::Hit> hits;
+    {
+        Profiler::Scope scope(file->filename, "serve_query");
+        BatchQuery::execute(*file->index, query, hits);
+        Profiler::count(Profiler::QueryHits, hits.size());
+    }
+
+    const PointCloud &cloud = file->index->cloud();
+    out << "OK " << hits.size() << "\n";
+    for (const BatchQuery::Hit &hit : hits)
+    {
+        Point point = cloud[hit.index];
+        out << cloud.sourceIndex(hit.index) << " " << point.x << " " << point.y << " " << point.z;
+        if (query.type == BatchQuery::Query::Nearest)
+        {
+            out << " " << hit.distance;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+const QueryServer::ServedFile *QueryServer::find(const std::string &name) const
+{
+    for (const ServedFile &file : files_)
+    {
+        size_t slash = file.filename.find_last_of('/');
+        if (file.filename == name || (slash != std::string::npos && file.filename.compare(slash + 1, std::string::npos, name) == 0))
+        {
+            return &file;
+        }
+    }
+    return nullptr;
+}
+
+void QueryServer::serveClient(int client) const
+{
+    std::string pending;
+    char buffer[4096];
+    while (!stopping_)
+    {
+        pollfd ready = {client, POLLIN, 0};
+        int count = poll(&ready, 1, kPollMilliseconds);
+        if (count == 0 || (count < 0 && errno == EINTR))
+        {
+            continue;
+        }
+        ssize_t bytes = count > 0 ? recv(client, buffer, sizeof(buffer), 0) : -1;
+        if (bytes <= 0)
+        {
+            return;
+        }
+        pending.append(buffer, static_cast<size_t>(bytes));
+
+        // Answer every complete line; pipelined requests are answered in order
+        size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos)
+        {
+            std::string request = pending.substr(start, end - start);
+            start = end + 1;
+            if (!request.empty() && request.back() == '\r')
+            {
+                request.pop_back();
+            }
+            std::string response = respond(request);
+            if (response.empty() || !sendAll(client, response))
+            {
+                return;
+            }
+        }
+        pending.erase(0, start);
+        if (pending.size() > kMaxRequestBytes)
+        {
+            sendAll(client, error("Request too long."));
+            return;
+        }
+    }
+}
+
+bool QueryServer::sendAll(int client, const std::string &data)
+{
+    // MSG_NOSIGNAL: a client that went away must not kill the server with SIGPIPE
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t bytes = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(bytes);
+    }
+    return true;
+}
+
+std::string QueryServer::error(const std::string &message)
+{
+    return "ERROR " + message + "\n";
+}
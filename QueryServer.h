@@ -0,0 +1,102 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "KDTree.h"
+#include "Point.h"
+
+/**
+ * @brief Answers region queries on resident KD-trees over a Unix domain socket.
+ *
+ * The files are loaded and indexed once, their bounding box and centroid
+ * computed, and everything stays in memory until the server stops. Every
+ * client connection is served by its own thread, and the trees are only
+ * read, so clients query concurrently without locking.
+ *
+ * Requests are single lines, with the query syntax of BatchQuery after the
+ * file name:
+ *
+ *     files
+ *     stats <file>
+ *     sphere <file> <x> <y> <z> <diameter>
+ *     box <file> <min x> <min y> <min z> <max x> <max y> <max z>
+ *     knn <file> <x> <y> <z> <k>
+ *     color <file> <min r> <min g> <min b> <max r> <max g> <max b>
+ *     quit
+ *
+ * A file is named by its path as listed by "files" or by its base name.
+ * Every request except quit gets "OK <n>" followed by n result lines, or a
+ * single "ERROR <message>" line. "files" lists one "<file> <points>" line
+ * per file; "stats" prints "points <n>", "min <x> <y> <z>", "max <x> <y> <z>"
+ * and "centroid <x> <y> <z>"; queries print one "<row> <x> <y> <z>" line
+ * per hit, knn hits with their distance appended. Rows are source rows of
+ * the file, sphere, box and colour hits come in file order and knn hits nearest
+ * first. Numbers are written with enough digits to read back exactly.
+ */
+class QueryServer
+{
+public:
+    QueryServer() = default;
+    ~QueryServer();
+    QueryServer(const QueryServer &) = delete;
+    QueryServer &operator=(const QueryServer &) = delete;
+
+    /**
+     * @brief Serves @p filename from @p index, computing its statistics now.
+     */
+    void add(const std::string &filename, std::shared_ptr<const KDTree> index);
+
+    size_t fileCount() const { return files_.size(); }
+
+    /**
+     * @brief Creates the socket at @p socketPath; clients can connect from now on.
+     *
+     * A stale socket left at the path is replaced; any other file there is not.
+     *
+     * @return false, after writing the reason to @p errors, if the socket cannot be set up.
+     */
+    bool listen(const std::string &socketPath, std::ostream &errors);
+
+    /**
+     * @brief Serves the clients of the socket until stop() is called, then removes the socket.
+     */
+    void run();
+
+    /**
+     * @brief Makes run() return once the connected clients are closed; safe to call from a signal handler.
+     */
+    static void stop() { stopping_ = true; }
+
+    /**
+     * @brief The full response to one request line, empty for quit.
+     */
+    std::string respond(const std::string &request) const;
+
+private:
+    struct ServedFile
+    {
+        std::string filename;
+        std::shared_ptr<const KDTree> index;
+        Point low, high, centroid;
+    };
+
+    const ServedFile *find(const std::string &name) const;
+    void serveClient(int client) const;
+    static bool sendAll(int client, const std::string &data);
+    static std::string error(const std::string &message);
+
+    // Longest wait between stop() checks, and the longest request line accepted
+    static const int kPollMilliseconds = 250;
+    static const size_t kMaxRequestBytes = size_t(1) << 16;
+
+    std::vector<ServedFile> files_;
+    std::string socketPath_;
+    int listener_ = -1;
+    static inline std::atomic<bool> stopping_{false};
+};
+
+#endif // QUERY_SERVER_H
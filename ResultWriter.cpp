@@ -0,0 +1,202 @@
+#include "ResultWriter.h"
+#include "BinaryPointFile.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // Width reserved for the POINTS count, enough for any size_t
+    const size_t kCountWidth = 20;
+
+    bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+}
+
+ResultWriter::ResultWriter(std::ostream &out)
+    : out_(out), buffer_(kBufferSize)
+{
+}
+
+ResultWriter::~ResultWriter()
+{
+    flush();
+}
+
+char *ResultWriter::reserve(size_t bytes)
+{
+    if (used_ + bytes > buffer_.size())
+    {
+        out_.write(buffer_.data(), used_);
+        used_ = 0;
+        if (bytes > buffer_.size())
+        {
+            buffer_.resize(bytes);
+        }
+    }
+    return buffer_.data() + used_;
+}
+
+ResultWriter &ResultWriter::write(const std::string &text)
+{
+    std::memcpy(reserve(text.size()), text.data(), text.size());
+    used_ += text.size();
+    return *this;
+}
+
+ResultWriter &ResultWriter::write(char c)
+{
+    *reserve(1) = c;
+    ++used_;
+    return *this;
+}
+
+ResultWriter &ResultWriter::writeFixed(double value, int precision)
+{
+    // 330 characters hold any double in fixed notation with up to 16 decimals
+    char *begin = reserve(330 + precision);
+    char *end = std::to_chars(begin, begin + 330 + precision, value, std::chars_format::fixed, precision).ptr;
+    used_ += end - begin;
+    return *this;
+}
+
+ResultWriter &ResultWriter::writeInteger(uint64_t value)
+{
+    char *begin = reserve(20);
+    char *end = std::to_chars(begin, begin + 20, value).ptr;
+    used_ += end - begin;
+    return *this;
+}
+
+ResultWriter &ResultWriter::writePoint(const Point &point)
+{
+    write('(').writeFixed(point.x, 3).write(", ").writeFixed(point.y, 3).write(", ").writeFixed(point.z, 3);
+    return write(")\n");
+}
+
+void ResultWriter::flush()
+{
+    out_.write(buffer_.data(), used_);
+    used_ = 0;
+    out_.flush();
+}
+
+PointFileWriter::~PointFileWriter()
+{
+    close();
+}
+
+bool PointFileWriter::open(const std::string &filename, bool hasColor, bool binary)
+{
+    close();
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    filename_ = filename;
+    hasColor_ = hasColor;
+    binary_ = binary;
+    writeOk_ = true;
+    count_ = 0;
+
+    std::string header = std::string("VERSION 1\nFORMAT ") + (hasColor ? "x y z r g b" : "x y z") + "\nPOINTS ";
+    countOffset_ = header.size();
+    header += std::string(kCountWidth, ' ') + "\nDATA " + (binary ? "binary" : "ascii") + "\n";
+    buffer_.assign(header.begin(), header.end());
+    buffer_.reserve(ResultWriter::kBufferSize + 128);
+    return true;
+}
+
+void PointFileWriter::add(const Point &point, uint32_t rgb)
+{
+    unsigned char channels[3];
+    PointCloud::unpackColor(rgb, channels);
+    size_t offset = buffer_.size();
+    if (binary_)
+    {
+        buffer_.resize(offset + BinaryPointFile::recordSize(hasColor_));
+        unsigned char *record = reinterpret_cast<unsigned char *>(&buffer_[offset]);
+        BinaryPointFile::storeDouble(point.x, record);
+        BinaryPointFile::storeDouble(point.y, record + 8);
+        BinaryPointFile::storeDouble(point.z, record + 16);
+        if (hasColor_)
+        {
+            std::memcpy(record + 24, channels, 3);
+        }
+    }
+    else
+    {
+        // Shortest text that reads back to the same double
+        buffer_.resize(offset + 128);
+        char *cursor = &buffer_[offset];
+        char *end = cursor + 128;
+        const double values[3] = {point.x, point.y, point.z};
+        for (double value : values)
+        {
+            cursor = std::to_chars(cursor, end, value).ptr;
+            *cursor++ = ' ';
+        }
+        for (int c = 0; hasColor_ && c < 3; ++c)
+        {
+            cursor = std::to_chars(cursor, end, int(channels[c])).ptr;
+            *cursor++ = ' ';
+        }
+        cursor[-1] = '\n';
+        buffer_.resize(cursor - buffer_.data());
+    }
+    ++count_;
+
+    if (buffer_.size() >= ResultWriter::kBufferSize)
+    {
+        flushBuffer();
+    }
+}
+
+void PointFileWriter::flushBuffer()
+{
+    writeOk_ = writeAll(fd_, buffer_.data(), buffer_.size()) && writeOk_;
+    buffer_.clear();
+}
+
+bool PointFileWriter::close()
+{
+    if (fd_ < 0)
+    {
+        return writeOk_;
+    }
+    if (count_ == 0)
+    {
+        // "POINTS 0" would not pass validation, so no file is better than an invalid one
+        writeOk_ = ::close(fd_) == 0 && unlink(filename_.c_str()) == 0;
+        fd_ = -1;
+        return writeOk_;
+    }
+    flushBuffer();
+
+    // Fill in the count, the rest of the reserved width stays blank
+    char count[kCountWidth];
+    char *end = std::to_chars(count, count + kCountWidth, count_).ptr;
+    writeOk_ = pwrite(fd_, count, end - count, static_cast<off_t>(countOffset_)) == end - count && writeOk_;
+    writeOk_ = ::close(fd_) == 0 && writeOk_;
+    fd_ = -1;
+    return writeOk_;
+}
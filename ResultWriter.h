@@ -0,0 +1,93 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Point.h"
+
+/**
+ * @brief Buffered text output for large result sets.
+ *
+ * Text is formatted with std::to_chars straight into a 1 MiB buffer that is
+ * handed to the stream in one write when it fills up, so printing millions
+ * of points costs neither a flush nor a locale-aware conversion per line.
+ * The text is byte-for-byte what std::fixed and std::setprecision produce.
+ */
+class ResultWriter
+{
+public:
+    static constexpr size_t kBufferSize = 1 << 20;
+
+    explicit ResultWriter(std::ostream &out);
+    ~ResultWriter();
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter &operator=(const ResultWriter &) = delete;
+
+    ResultWriter &write(const std::string &text);
+    ResultWriter &write(char c);
+    ResultWriter &writeFixed(double value, int precision);
+    ResultWriter &writeInteger(uint64_t value);
+
+    /**
+     * @brief Writes "(x, y, z)" and a newline with three decimals, the way the menu prints points.
+     */
+    ResultWriter &writePoint(const Point &point);
+
+    /**
+     * @brief Hands the buffered text to the stream and flushes it.
+     */
+    void flush();
+
+private:
+    char *reserve(size_t bytes);
+
+    std::ostream &out_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+};
+
+/**
+ * @brief Writes a valid .pt file point by point, without knowing the count in advance.
+ *
+ * The POINTS line is written with room for any count and filled in by
+ * close(). A .pt file needs at least one point, so a file that got no rows
+ * is removed by close() instead of being left invalid. Rows are ascii with the shortest text that reads back to the
+ * same double, or binary records as described in BinaryPointFile.
+ */
+class PointFileWriter
+{
+public:
+    PointFileWriter() = default;
+    ~PointFileWriter();
+    PointFileWriter(const PointFileWriter &) = delete;
+    PointFileWriter &operator=(const PointFileWriter &) = delete;
+
+    bool open(const std::string &filename, bool hasColor, bool binary);
+    void add(const Point &point, uint32_t rgb = 0);
+
+    /**
+     * @brief Writes the remaining rows and the final POINTS count, or removes the file if it has no rows.
+     *
+     * @return false if any write failed.
+     */
+    bool close();
+
+    size_t count() const { return count_; }
+
+private:
+    void flushBuffer();
+
+    int fd_ = -1;
+    std::string filename_;
+    bool hasColor_ = false;
+    bool binary_ = false;
+    bool writeOk_ = true;
+    size_t count_ = 0;
+    size_t countOffset_ = 0; // Byte offset of the count in the POINTS line
+    std::vector<char> buffer_;
+};
+
+#endif // RESULT_WRITER_H
@@ -0,0 +1,190 @@
+#include "SpatialOrder.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+bool SpatialOrder::reorder(PointCloud &cloud, Curve curve, ThreadPool &pool)
+{
+    if (curve == Curve::None || cloud.storage() != PointCloud::Storage::Double ||
+        cloud.size() >= std::numeric_limits<uint32_t>::max())
+    {
+        return false;
+    }
+    cloud.permute(sortedOrder(codes(cloud, curve, pool), pool));
+    return true;
+}
+
+PointCloud::Array<uint64_t> SpatialOrder::codes(const PointCloud &cloud, Curve curve, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    PointCloud::Array<uint64_t> result(n, 0, cloud.allocator<uint64_t>());
+    if (n == 0)
+    {
+        return result;
+    }
+
+    // Each axis is stretched over the full 21 bits, so flat clouds keep their resolution
+    Point low, high;
+    cloud.bounds(0, n, low, high);
+    const double lows[3] = {low.x, low.y, low.z};
+    const double highs[3] = {high.x, high.y, high.z};
+    const double levels = double((uint32_t(1) << kBitsPerAxis) - 1);
+    double scales[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        scales[axis] = highs[axis] > lows[axis] ? levels / (highs[axis] - lows[axis]) : 0;
+    }
+
+    const size_t chunks = (n + kSortChunkSize - 1) / kSortChunkSize;
+    pool.parallelFor(chunks, [&](size_t chunk)
+    {
+        const size_t end = std::min(n, (chunk + 1) * kSortChunkSize);
+        for (size_t i = chunk * kSortChunkSize; i < end; ++i)
+        {
+            Point point = cloud[i];
+            const double values[3] = {point.x, point.y, point.z};
+            uint32_t cells[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                cells[axis] = static_cast<uint32_t>(std::min((values[axis] - lows[axis]) * scales[axis], levels));
+            }
+            result[i] = curve == Curve::Hilbert ? hilbertCode(cells[0], cells[1], cells[2])
+                                                : mortonCode(cells[0], cells[1], cells[2]);
+        }
+    });
+    return result;
+}
+
+PointCloud::Array<uint32_t> SpatialOrder::sortedOrder(const PointCloud::Array<uint64_t> &keys, ThreadPool &pool)
+{
+    const size_t n = keys.size();
+    const size_t buckets = size_t(1) << kDigitBits;
+    PointCloud::Array<uint32_t> order(n, 0, keys.get_allocator()), scratch(n, 0, keys.get_allocator());
+    std::iota(order.begin(), order.end(), uint32_t(0));
+    PointCloud::Array<uint64_t> sortedKeys(keys), scratchKeys(n, 0, keys.get_allocator());
+
+    // Every pass counts the digits per chunk, then each chunk scatters its points
+    // to its own slots; the chunks do not depend on the thread count and the sort is stable
+    const size_t chunks = (n + kSortChunkSize - 1) / kSortChunkSize;
+    std::vector<size_t> counts(chunks * buckets);
+    for (int shift = 0; shift < 64; shift += kDigitBits)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        pool.parallelFor(chunks, [&](size_t chunk)
+        {
+            size_t *chunkCounts = &counts[chunk * buckets];
+            const size_t end = std::min(n, (chunk + 1) * kSortChunkSize);
+            for (size_t i = chunk * kSortChunkSize; i < end; ++i)
+            {
+                ++chunkCounts[(sortedKeys[i] >> shift) & (buckets - 1)];
+            }
+        });
+
+        // Bucket-major, chunk-minor offsets; a digit shared by every key needs no pass
+        size_t offset = 0;
+        bool allEqual = false;
+        for (size_t bucket = 0; bucket < buckets; ++bucket)
+        {
+            size_t bucketTotal = 0;
+            for (size_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                size_t count = counts[chunk * buckets + bucket];
+                counts[chunk * buckets + bucket] = offset;
+                offset += count;
+                bucketTotal += count;
+            }
+            allEqual = allEqual || bucketTotal == n;
+        }
+        if (allEqual)
+        {
+            continue;
+        }
+
+        pool.parallelFor(chunks, [&](size_t chunk)
+        {
+            size_t *next = &counts[chunk * buckets];
+            const size_t end = std::min(n, (chunk + 1) * kSortChunkSize);
+            for (size_t i = chunk * kSortChunkSize; i < end; ++i)
+            {
+                size_t target = next[(sortedKeys[i] >> shift) & (buckets - 1)]++;
+                scratchKeys[target] = sortedKeys[i];
+                scratch[target] = order[i];
+            }
+        });
+        sortedKeys.swap(scratchKeys);
+        order.swap(scratch);
+    }
+    return order;
+}
+
+uint64_t SpatialOrder::spreadBits(uint64_t value)
+{
+    // Spreads the low 21 bits of value so that two zero bits follow each one
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffULL;
+    value = (value | value << 16) & 0x1f0000ff0000ffULL;
+    value = (value | value << 8) & 0x100f00f00f00f00fULL;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ULL;
+    value = (value | value << 2) & 0x1249249249249249ULL;
+    return value;
+}
+
+uint64_t SpatialOrder::mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2;
+}
+
+uint64_t SpatialOrder::hilbertCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    // Skilling's transform ("Programming the Hilbert curve", 2004) turns the
+    // coordinates into the transposed Hilbert index, which is then interleaved
+    uint32_t axes[3] = {x, y, z};
+    const uint32_t top = uint32_t(1) << (kBitsPerAxis - 1);
+    for (uint32_t q = top; q > 1; q >>= 1)
+    {
+        // Branch-free: invert the low bits of axes[0] if bit q is set, else exchange them with axes[i]
+        const uint32_t lower = q - 1;
+        for (int i = 0; i < 3; ++i)
+        {
+            const uint32_t set = 0u - ((axes[i] & q) != 0);
+            const uint32_t swap = (axes[0] ^ axes[i]) & lower & ~set;
+            axes[0] ^= (lower & set) | swap;
+            axes[i] ^= swap;
+        }
+    }
+    for (int i = 1; i < 3; ++i)
+    {
+        axes[i] ^= axes[i - 1];
+    }
+    uint32_t gray = 0;
+    for (uint32_t q = top; q > 1; q >>= 1)
+    {
+        gray ^= (q - 1) & (0u - ((axes[2] & q) != 0));
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        axes[i] ^= gray;
+    }
+    return spreadBits(axes[0]) << 2 | spreadBits(axes[1]) << 1 | spreadBits(axes[2]);
+}
+
+bool SpatialOrder::parseCurve(const std::string &name, Curve &curve)
+{
+    if (name == "none")
+    {
+        curve = Curve::None;
+    }
+    else if (name == "morton")
+    {
+        curve = Curve::Morton;
+    }
+    else if (name == "hilbert")
+    {
+        curve = Curve::Hilbert;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
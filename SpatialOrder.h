@@ -0,0 +1,75 @@
+#ifndef SPATIAL_ORDER_H
+#define SPATIAL_ORDER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Sorts the points of a cloud along a space-filling curve.
+ *
+ * Point files list their rows in acquisition order, which is scattered in
+ * space, so neighbouring points end up far apart in memory. Sorting the
+ * cloud by the Morton (Z-order) or Hilbert code of its points puts points
+ * that are close in space close in memory, which helps the KD-tree build,
+ * the grid and tile kernels and the queries.
+ *
+ * Coordinates are quantized to 21 bits per axis over the cloud's bounding
+ * box, giving 63-bit codes, which are sorted with a stable parallel LSD
+ * radix sort. The permuted cloud remembers the source row of every point.
+ */
+class SpatialOrder
+{
+public:
+    enum class Curve
+    {
+        None,
+        Morton,
+        Hilbert
+    };
+
+    /**
+     * @brief Sorts @p cloud along @p curve; returns false, leaving it unchanged, if it cannot.
+     *
+     * Only Storage::Double clouds of fewer than 2^32 points are reordered.
+     */
+    static bool reorder(PointCloud &cloud, Curve curve, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Curve code of every point of @p cloud, charged to the cloud's account.
+     */
+    static PointCloud::Array<uint64_t> codes(const PointCloud &cloud, Curve curve, ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Indices that sort @p keys ascending, equal keys in index order.
+     *
+     * The order and the sort buffers are allocated like @p keys, so they are
+     * charged to the same account.
+     */
+    static PointCloud::Array<uint32_t> sortedOrder(const PointCloud::Array<uint64_t> &keys,
+                                                   ThreadPool &pool = ThreadPool::shared());
+
+    /**
+     * @brief Morton and Hilbert codes of a point quantized to 21 bits per axis.
+     */
+    static uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z);
+    static uint64_t hilbertCode(uint32_t x, uint32_t y, uint32_t z);
+
+    /**
+     * @brief Parses "none", "morton" or "hilbert".
+     */
+    static bool parseCurve(const std::string &name, Curve &curve);
+
+    static constexpr int kBitsPerAxis = 21;
+
+private:
+    static uint64_t spreadBits(uint64_t value);
+
+    // Radix sort digits, and the number of points per histogram chunk
+    static constexpr int kDigitBits = 8;
+    static constexpr size_t kSortChunkSize = size_t(1) << 16;
+};
+
+#endif // SPATIAL_ORDER_H
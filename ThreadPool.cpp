@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+    // Index of the pool worker running on this thread, or -1 for other threads
+    thread_local long tlsWorkerIndex = -1;
+    thread_local const ThreadPool *tlsWorkerPool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        queues_.emplace_back(new Queue());
+    }
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::push(std::function<void()> task)
+{
+    // Workers keep their own subtasks local, other threads spread them round-robin
+    size_t target = (tlsWorkerPool == this) ? static_cast<size_t>(tlsWorkerIndex)
+                                            : nextQueue_++ % queues_.size();
+    {
+        // Counted before it is queued, so pending_ never drops below the queued tasks
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        ++pending_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::runOne()
+{
+    if (pending_ == 0)
+    {
+        return false;
+    }
+
+    std::function<void()> task;
+    size_t own = (tlsWorkerPool == this) ? static_cast<size_t>(tlsWorkerIndex) : 0;
+    {
+        // Newest task of our own deque first
+        std::lock_guard<std::mutex> lock(queues_[own]->mutex);
+        if (!queues_[own]->tasks.empty())
+        {
+            task = std::move(queues_[own]->tasks.back());
+            queues_[own]->tasks.pop_back();
+        }
+    }
+    for (size_t offset = 1; !task && offset < queues_.size(); ++offset)
+    {
+        // Otherwise steal the oldest task of another deque
+        Queue &victim = *queues_[(own + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+
+    --pending_;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    tlsWorkerIndex = static_cast<long>(index);
+    tlsWorkerPool = this;
+    while (true)
+    {
+        if (runOne())
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this]() { return stopping_ || pending_ > 0; });
+        if (stopping_ && pending_ == 0)
+        {
+            return;
+        }
+    }
+}
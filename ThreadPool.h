@@ -0,0 +1,141 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing thread pool shared by file-level and chunk-level work.
+ *
+ * Every worker owns a deque. Tasks submitted from a worker go to the back of
+ * its own deque and are taken LIFO, which keeps nested work (the chunks of a
+ * file the worker is loading) hot in its cache. Idle workers steal from the
+ * front of the other deques. A thread waiting in parallelFor() keeps running
+ * queued tasks instead of blocking, so nested parallelFor() calls cannot
+ * deadlock the pool.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @param threads Number of workers, 0 for one per hardware thread.
+     */
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    /**
+     * @brief Runs body(i) for every i in [0, count) and returns when all are done.
+     *
+     * The calling thread takes part in the work. The first exception thrown
+     * by a body is rethrown here once every index has finished.
+     */
+    template <typename Body>
+    void parallelFor(size_t count, Body body);
+
+    /**
+     * @brief Pool used by the analyses, sized to the machine.
+     */
+    static ThreadPool &shared();
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(std::function<void()> task);
+    bool runOne();
+    void workerLoop(size_t index);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> nextQueue_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+template <typename Body>
+void ThreadPool::parallelFor(size_t count, Body body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (count == 1 || workers_.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            body(i);
+        }
+        return;
+    }
+
+    // One task per worker; each claims indices until none are left, so a
+    // million small bodies cost a handful of queue operations
+    std::atomic<size_t> nextIndex(0);
+    std::atomic<size_t> remaining(count);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto drain = [&]()
+    {
+        for (size_t i = nextIndex++; i < count; i = nextIndex++)
+        {
+            try
+            {
+                body(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+            --remaining;
+        }
+    };
+
+    const size_t tasks = std::min(count - 1, workers_.size());
+    std::atomic<size_t> tasksLeft(tasks);
+    for (size_t t = 0; t < tasks; ++t)
+    {
+        push([&]()
+        {
+            drain();
+            --tasksLeft;
+        });
+    }
+    drain();
+
+    // Keep working on other queued tasks until every index and every helper task is done;
+    // the helpers reference this frame, so it must outlive them
+    while (remaining > 0 || tasksLeft > 0)
+    {
+        if (!runOne())
+        {
+            std::this_thread::yield();
+        }
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif // THREAD_POOL_H
@@ -51,7 +51,12 @@ bool Utils::checkFormat(const std::string &line)
 
 bool Utils::checkData(const std::string &line)
 {
-    return (line == "DATA ascii");
+    return (line == "DATA ascii" || line == "DATA binary");
+}
+
+bool Utils::isBinaryData(const std::string &line)
+{
+    return (line == "DATA binary");
 }
 
 bool Utils::checkPointsCount(const std::string &line, int &count)
@@ -10,6 +10,7 @@ public:
     static bool checkVersion(const std::string &line);
     static bool checkFormat(const std::string &line);
     static bool checkData(const std::string &line);
+    static bool isBinaryData(const std::string &line);
     static bool checkPointsCount(const std::string &line, int &count);
 };
 
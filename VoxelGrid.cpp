@@ -0,0 +1,138 @@
+#include "VoxelGrid.h"
+#include "SpatialOrder.h"
+#include <algorithm>
+#include <cmath>
+
+bool VoxelGrid::downsample(const PointCloud &cloud, double voxelSize, Result &result, ThreadPool &pool)
+{
+    const size_t n = cloud.size();
+    result = Result();
+    result.inputPoints = n;
+    if (n >= ~uint32_t(0))
+    {
+        return false;
+    }
+    if (n == 0)
+    {
+        result.voxelSize = voxelSize;
+        return true;
+    }
+
+    Point low, high;
+    cloud.bounds(0, n, low, high);
+
+    // Voxels as large as asked for, unless that needs more than 21 bits per axis
+    const double extent = std::max(std::max(high.x - low.x, high.y - low.y), high.z - low.z);
+    result.voxelSize = std::max(voxelSize, extent / double(kMaxVoxel - 1));
+    const double inverseVoxelSize = result.voxelSize > 0 ? 1.0 / result.voxelSize : 0;
+
+    const size_t chunks = (n + kChunkSize - 1) / kChunkSize;
+    PointCloud::Array<uint64_t> keys(n, 0, cloud.allocator<uint64_t>());
+    pool.parallelFor(chunks, [&](size_t chunk)
+    {
+        // Compact clouds are decoded a block at a time instead of copied whole
+        const size_t end = std::min(n, (chunk + 1) * kChunkSize);
+        double xs[kDecodeBlock], ys[kDecodeBlock], zs[kDecodeBlock];
+        for (size_t begin = chunk * kChunkSize; begin < end; begin += kDecodeBlock)
+        {
+            const size_t count = std::min(end - begin, kDecodeBlock);
+            cloud.decode(begin, begin + count, xs, ys, zs);
+            for (size_t i = 0; i < count; ++i)
+            {
+                keys[begin + i] = voxelOf(xs[i] - low.x, inverseVoxelSize) | voxelOf(ys[i] - low.y, inverseVoxelSize) << 21 |
+                                  voxelOf(zs[i] - low.z, inverseVoxelSize) << 42;
+            }
+        }
+    });
+
+    // Sorted by key every voxel is a run of consecutive points, in cloud order within the run
+    const PointCloud::Array<uint32_t> order = SpatialOrder::sortedOrder(keys, pool);
+    std::vector<uint32_t> runStarts;
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (k == 0 || keys[order[k]] != keys[order[k - 1]])
+        {
+            runStarts.push_back(static_cast<uint32_t>(k));
+        }
+    }
+    const size_t voxels = runStarts.size();
+    runStarts.push_back(static_cast<uint32_t>(n));
+    PointCloud::Array<uint64_t>(keys.get_allocator()).swap(keys);
+
+    const bool withColor = cloud.hasColor();
+    std::vector<Point> centroids(voxels);
+    std::vector<uint32_t> colors(withColor ? voxels : 0);
+    std::vector<size_t> firstRows(voxels);
+    const size_t voxelChunks = (voxels + kVoxelChunkSize - 1) / kVoxelChunkSize;
+    pool.parallelFor(voxelChunks, [&](size_t chunk)
+    {
+        const size_t end = std::min(voxels, (chunk + 1) * kVoxelChunkSize);
+        for (size_t voxel = chunk * kVoxelChunkSize; voxel < end; ++voxel)
+        {
+            double sumX = 0, sumY = 0, sumZ = 0;
+            uint64_t sumRgb[3] = {0, 0, 0};
+            size_t firstRow = cloud.sourceIndex(order[runStarts[voxel]]);
+            for (size_t k = runStarts[voxel]; k < runStarts[voxel + 1]; ++k)
+            {
+                const uint32_t point = order[k];
+                const Point position = cloud[point];
+                sumX += position.x - low.x;
+                sumY += position.y - low.y;
+                sumZ += position.z - low.z;
+                firstRow = std::min(firstRow, cloud.sourceIndex(point));
+                if (withColor)
+                {
+                    unsigned char rgb[3];
+                    PointCloud::unpackColor(cloud.color(point), rgb);
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        sumRgb[channel] += rgb[channel];
+                    }
+                }
+            }
+            const size_t count = runStarts[voxel + 1] - runStarts[voxel];
+            centroids[voxel] = Point{low.x + sumX / count, low.y + sumY / count, low.z + sumZ / count};
+            firstRows[voxel] = firstRow;
+            if (withColor)
+            {
+                // Rounded to the nearest channel value
+                colors[voxel] = PointCloud::packColor(static_cast<unsigned char>((sumRgb[0] + count / 2) / count),
+                                                      static_cast<unsigned char>((sumRgb[1] + count / 2) / count),
+                                                      static_cast<unsigned char>((sumRgb[2] + count / 2) / count));
+            }
+        }
+    });
+
+    // Voxels in the order their first point was read, so the output follows the file
+    std::vector<uint32_t> voxelOrder(voxels);
+    for (size_t voxel = 0; voxel < voxels; ++voxel)
+    {
+        voxelOrder[voxel] = static_cast<uint32_t>(voxel);
+    }
+    std::sort(voxelOrder.begin(), voxelOrder.end(), [&firstRows](uint32_t a, uint32_t b) { return firstRows[a] < firstRows[b]; });
+
+    result.centroids.reserve(voxels, withColor);
+    for (uint32_t voxel : voxelOrder)
+    {
+        if (withColor)
+        {
+            result.centroids.add(centroids[voxel], colors[voxel]);
+        }
+        else
+        {
+            result.centroids.add(centroids[voxel]);
+        }
+    }
+    return true;
+}
+
+uint64_t VoxelGrid::voxelOf(double offset, double inverseVoxelSize)
+{
+    // NaN coordinates land in voxel 0
+    double voxel = std::floor(offset * inverseVoxelSize);
+    if (!(voxel > 0))
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::min(voxel, double(kMaxVoxel - 1)));
+}
@@ -0,0 +1,56 @@
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include <cstddef>
+#include <cstdint>
+#include "PointCloud.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Voxel-grid downsampling: one centroid per occupied voxel.
+ *
+ * The voxels are cubes of the given size aligned with the bounding box
+ * minimum (larger only if the cloud spans more than 2^21 voxels on an
+ * axis). Points are keyed by their voxel and the keys sorted with
+ * SpatialOrder's parallel radix sort, so every voxel becomes one run of
+ * points whose centroid, and average colour for RGB clouds, is summed by a
+ * single thread. Sums are taken relative to the bounding box minimum so
+ * that georeferenced coordinates keep their precision. The centroids come
+ * out in the order of each voxel's first row in the file, and the result
+ * does not depend on the thread count.
+ */
+class VoxelGrid
+{
+public:
+    struct Result
+    {
+        double voxelSize = 0; // Edge length actually used
+        PointCloud centroids; // One point per occupied voxel, coloured like the input
+        size_t inputPoints = 0;
+
+        double reduction() const { return centroids.empty() ? 0 : double(inputPoints) / centroids.size(); }
+    };
+
+    /**
+     * @brief Replaces the points of every voxel of @p voxelSize by their centroid.
+     *
+     * The centroids are charged to the memory budget like any other cloud,
+     * the voxel keys and their sorted order to the account of @p cloud.
+     *
+     * @return false, leaving @p result empty, for clouds of 2^32 points or more.
+     */
+    static bool downsample(const PointCloud &cloud, double voxelSize, Result &result, ThreadPool &pool = ThreadPool::shared());
+
+private:
+    static uint64_t voxelOf(double offset, double inverseVoxelSize);
+
+    // Voxel coordinates take 21 bits each, x lowest
+    static constexpr uint64_t kMaxVoxel = uint64_t(1) << 21;
+
+    // Points per key chunk, points decoded at a time within it, and voxels per centroid chunk
+    static constexpr size_t kChunkSize = size_t(1) << 16;
+    static constexpr size_t kDecodeBlock = 1024;
+    static constexpr size_t kVoxelChunkSize = size_t(1) << 12;
+};
+
+#endif // VOXEL_GRID_H
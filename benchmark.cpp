@@ -0,0 +1,282 @@
+// Benchmark of the point analyzer's building blocks on generated point sets.
+//
+//   g++ -O2 -pthread -o benchmark benchmark.cpp -std=c++17
+//   ./benchmark --sizes 1000,100000,1000000 --distribution clustered --json
+//
+// Every phase of every size becomes one CSV row (or JSON object) so that
+// runs of different builds can be compared line by line.
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Utils.cpp"
+#include "Profiler.cpp"
+#include "MemoryBudget.cpp"
+#include "ThreadPool.cpp"
+#include "PointLoader.cpp"
+#include "BinaryPointFile.cpp"
+#include "PairSearch.cpp"
+#include "KDTree.cpp"
+#include "AverageDistance.cpp"
+#include "PointValidator.cpp"
+#include "PointGenerator.cpp"
+
+#ifndef __VERSION__
+#define __VERSION__ "unknown"
+#endif
+
+// Results are stored here so the compiler cannot drop the timed work
+volatile double gSink = 0;
+
+// Largest point count --sizes accepts, far beyond what fits in memory
+const double kMaxSize = 1e12;
+
+struct BenchmarkRow
+{
+    size_t points;
+    std::string phase;
+    double seconds;
+    double items; // Work done in the phase, in points, queries or pairs
+};
+
+template <typename Body>
+double _timeSeconds(Body body)
+{
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool _parseSize(const std::string &text, unsigned long long &value)
+{
+    // The whole argument must be digits, so "-1" is refused instead of wrapping around
+    const char *end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+bool _parseSizes(const std::string &list, std::vector<size_t> &sizes)
+{
+    // Whole point counts, in plain or exponent notation ("1e6")
+    sizes.clear();
+    std::istringstream iss(list);
+    std::string size;
+    while (getline(iss, size, ','))
+    {
+        double value;
+        const char *end = size.data() + size.size();
+        std::from_chars_result result = std::from_chars(size.data(), end, value);
+        if (size.empty() || result.ec != std::errc() || result.ptr != end || !(value >= 1 && value <= kMaxSize) ||
+            value != std::floor(value))
+        {
+            return false;
+        }
+        sizes.push_back(static_cast<size_t>(value));
+    }
+    return !sizes.empty();
+}
+
+// Times every phase on one generated file, returns false if the file could not be generated or read
+bool _benchmarkSize(const std::string &filename, const PointGenerator::Options &options, size_t queryCount,
+                    size_t averageLimit, std::vector<BenchmarkRow> &rows)
+{
+    const size_t n = options.count;
+    bool generated = false;
+    rows.push_back(BenchmarkRow{n, "generate", _timeSeconds([&]() { generated = PointGenerator::write(filename, options); }), double(n)});
+    if (!generated)
+    {
+        return false;
+    }
+
+    PointFileHeader header;
+    ValidationReport report;
+    bool validated = false;
+    rows.push_back(BenchmarkRow{n, "validate", _timeSeconds([&]()
+    {
+        validated = PointLoader::readHeader(filename, header) &&
+                    (header.binary || PointValidator::validateRows(filename, header, report));
+    }), double(n)});
+
+    std::shared_ptr<PointCloud> cloud = std::make_shared<PointCloud>();
+    bool loaded = false;
+    rows.push_back(BenchmarkRow{n, "load", _timeSeconds([&]() { loaded = PointLoader::loadPoints(filename, *cloud); }), double(n)});
+    std::remove(filename.c_str());
+    if (!validated || !loaded || cloud->size() != n)
+    {
+        return false;
+    }
+
+    rows.push_back(BenchmarkRow{n, "closest_pair", _timeSeconds([&]() { gSink = PairSearch::closestPair(*cloud).distanceSquared; }), double(n)});
+    rows.push_back(BenchmarkRow{n, "farthest_pair", _timeSeconds([&]() { gSink = PairSearch::farthestPair(*cloud).distanceSquared; }), double(n)});
+
+    Point low, high;
+    rows.push_back(BenchmarkRow{n, "bounding_box", _timeSeconds([&]()
+    {
+        cloud->bounds(0, n, low, high);
+        gSink = low.x + high.x;
+    }), double(n)});
+
+    std::shared_ptr<const KDTree> tree;
+    rows.push_back(BenchmarkRow{n, "kdtree_build", _timeSeconds([&]() { tree = std::make_shared<KDTree>(cloud); }), double(n)});
+
+    // Spheres around random points, sized to hold about 100 points of a uniform set
+    std::mt19937_64 random(options.seed + 1);
+    std::uniform_int_distribution<size_t> pick(0, n - 1);
+    const double radius = options.extent * std::cbrt(100.0 / n);
+    std::vector<Point> centres(queryCount);
+    for (Point &centre : centres)
+    {
+        centre = (*cloud)[pick(random)];
+    }
+    size_t hits = 0;
+    rows.push_back(BenchmarkRow{n, "sphere_query", _timeSeconds([&]()
+    {
+        std::vector<size_t> found;
+        for (const Point &centre : centres)
+        {
+            found.clear();
+            tree->sphereQuery(centre, radius, found);
+            hits += found.size();
+        }
+        gSink = double(hits);
+    }), double(queryCount)});
+
+    if (n <= averageLimit)
+    {
+        AverageDistance::Result result;
+        rows.push_back(BenchmarkRow{n, "average_distance", _timeSeconds([&]() { result = AverageDistance::compute(*cloud); }),
+                                    double(result.pairCount)});
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+    PointGenerator::Options options;
+    std::string directory = "/tmp";
+    size_t queryCount = 1000;
+    size_t averageLimit = 200000; // The exact average is O(n^2)
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--sizes" && i + 1 < argc)
+        {
+            if (!_parseSizes(argv[++i], sizes))
+            {
+                std::cerr << "Invalid value for --sizes: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--distribution" && i + 1 < argc)
+        {
+            if (!PointGenerator::parseDistribution(argv[++i], options.distribution))
+            {
+                std::cerr << "Unknown distribution: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--rgb")
+        {
+            options.withColor = true;
+        }
+        else if (option == "--binary")
+        {
+            options.binary = true;
+        }
+        else if (option == "--dir" && i + 1 < argc)
+        {
+            directory = argv[++i];
+        }
+        else if (option == "--queries" && i + 1 < argc)
+        {
+            unsigned long long value;
+            if (!_parseSize(argv[++i], value))
+            {
+                std::cerr << "Invalid value for --queries: " << argv[i] << std::endl;
+                return 1;
+            }
+            queryCount = static_cast<size_t>(value);
+        }
+        else if (option == "--average-limit" && i + 1 < argc)
+        {
+            unsigned long long value;
+            if (!_parseSize(argv[++i], value))
+            {
+                std::cerr << "Invalid value for --average-limit: " << argv[i] << std::endl;
+                return 1;
+            }
+            averageLimit = static_cast<size_t>(value);
+        }
+        else if (option == "--json")
+        {
+            json = true;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    // Columns shared by every row, they identify the build and the machine
+    std::ostringstream context;
+    context << std::string(__VERSION__) << "," << AverageDistance::kernelName() << "," << ThreadPool::shared().size();
+
+    if (json)
+    {
+        std::cout << "[";
+    }
+    else
+    {
+        std::cout << "compiler,kernel,threads,points,distribution,rgb,data,phase,seconds,items_per_second" << std::endl;
+    }
+
+    bool first = true;
+    for (size_t size : sizes)
+    {
+        options.count = size;
+        std::vector<BenchmarkRow> rows;
+        std::string filename = directory + "/benchmark_" + std::to_string(size) + ".pt";
+        if (!_benchmarkSize(filename, options, queryCount, averageLimit, rows))
+        {
+            std::cerr << "Error benchmarking " << size << " points." << std::endl;
+            return 1;
+        }
+
+        for (const BenchmarkRow &row : rows)
+        {
+            double throughput = row.seconds > 0 ? row.items / row.seconds : 0;
+            if (json)
+            {
+                std::cout << (first ? "\n" : ",\n")
+                          << "  {\"compiler\": \"" << __VERSION__ << "\", \"kernel\": \"" << AverageDistance::kernelName()
+                          << "\", \"threads\": " << ThreadPool::shared().size() << ", \"points\": " << row.points
+                          << ", \"distribution\": \"" << PointGenerator::distributionName(options.distribution)
+                          << "\", \"rgb\": " << (options.withColor ? "true" : "false")
+                          << ", \"data\": \"" << (options.binary ? "binary" : "ascii")
+                          << "\", \"phase\": \"" << row.phase << "\", \"seconds\": " << row.seconds
+                          << ", \"items_per_second\": " << throughput << "}";
+            }
+            else
+            {
+                std::cout << context.str() << "," << row.points << "," << PointGenerator::distributionName(options.distribution)
+                          << "," << (options.withColor ? 1 : 0) << "," << (options.binary ? "binary" : "ascii")
+                          << "," << row.phase << "," << row.seconds << "," << throughput << std::endl;
+            }
+            first = false;
+        }
+    }
+    if (json)
+    {
+        std::cout << "\n]" << std::endl;
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <dirent.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <string>
 #include <fstream>
@@ -8,11 +9,42 @@
 #include <limits>
 #include <cmath>
 #include <iomanip> // For std::fixed and std::setprecision
+#include <algorithm>
 #include <sstream> // For std::istringstream
+#include <csignal>
+#include <chrono>
+#include <charconv>
 #include "Utils.cpp"
+#include "PointLoader.cpp"
+#include "BinaryPointFile.cpp"
+#include "PointCloudCache.cpp"
+#include "PairSearch.cpp"
+#include "KDTree.cpp"
+#include "AverageDistance.cpp"
+#include "ThreadPool.cpp"
+#include "PointStream.cpp"
+#include "PointValidator.cpp"
+#include "BatchQuery.cpp"
+#include "PointGenerator.cpp"
+#include "Profiler.cpp"
+#include "ResultWriter.cpp"
+#include "FullAnalysis.cpp"
+#include "PointWatcher.cpp"
+#include "SpatialOrder.cpp"
+#include "MemoryBudget.cpp"
+#include "DuplicateSearch.cpp"
+#include "ApproximateDistance.cpp"
+#include "VoxelGrid.cpp"
+#include "QueryServer.cpp"
 #include "Point.h"
 
 Utils utils;
+PointCloudCache pointCache;
+bool streamingMode = false; // --stream: read files chunk by chunk instead of through the cache
+bool profileJson = false;   // --profile-json: print the profile as JSON instead of a table
+std::string resultsDirectory; // --results-dir: write corner and sphere results there as .pt files
+bool binaryResults = false;   // --binary: binary batch results and .pt data sections
+double approximateTolerance = 0; // --approximate: relative error allowed for the average and farthest distances
 
 /**
  * @brief Lists all files in the point_sets directory.
@@ -28,18 +60,22 @@ void listFiles();
  * This function scans the 'point_sets' directory, checks each file for a proper extension, 
  * and validates the file format including the version, format, points count, and data type.
  * It returns a list of filenames that meet all criteria. Each file's header is checked for 
- * specific criteria, and the actual point count is compared against the expected count.
- * If any checks fail, the file is skipped. If the directory cannot be opened or if a file 
- * cannot be read, an error message is printed to stderr.
+ * specific criteria, every data row is checked against the FORMAT line with PointValidator,
+ * and the number of rows is compared against the expected count. If any checks fail, the file
+ * is skipped and the first invalid rows are reported as file:line:column. If the directory
+ * cannot be opened or if a file cannot be read, an error message is printed to stderr.
  * 
+ * @param warmCache Load every suitable file into the point cache while validating.
  * @return std::vector<std::string> List of filenames with valid point file headers.
  */
-std::vector<std::string> getSuitablePointFiles();
+std::vector<std::string> getSuitablePointFiles(bool warmCache = false);
 /**
  * @brief Finds the closest and farthest point pairs in a collection of point files.
  *
- * Iterates over provided files, calculates distances between points, and tracks the minimum
- * and maximum distances along with the corresponding point pairs.
+ * Iterates over provided files and finds the closest and farthest pair of each file with
+ * PairSearch, printing them per file. The minimum and maximum over all files are printed last.
+ * With --approximate the farthest pair comes from ApproximateDistance instead, and an upper
+ * bound on the distance within the tolerance is printed with it.
  *
  * @param files A list of filenames with point data.
  */
@@ -48,7 +84,8 @@ void checkClosestAndFarthestPoints(const std::vector<std::string> &files);
  * @brief Identifies the corner points of the smallest cube that contains all points in a collection of files.
  *
  * Iterates over provided files, reads the point data, and finds the minimum and maximum x, y, and z values.
- * The corner points of the smallest cube are then printed for each file.
+ * The corner points of the smallest cube are then printed for each file. In streaming mode the files
+ * are read in bounded chunks and the peak resident memory is printed last.
  *
  * @param files A list of filenames with point data.
  */
@@ -56,8 +93,10 @@ void identifyCornerPoints(const std::vector<std::string>& files);
 /**
  * @brief Prompts the user for a sphere center and diameter, then finds points within the sphere in a collection of files.
  *
- * Iterates over provided files, reads the point data, and finds points within the specified sphere.
- * The sphere center and diameter are prompted from the user.
+ * Iterates over provided files and finds points within the specified sphere with the file's
+ * KD-tree, which is built on the first query and kept in the point cache for later ones.
+ * In streaming mode the files are scanned chunk by chunk instead and every hit is printed as
+ * soon as it is found. The sphere center and diameter are prompted from the user.
  *
  * @param suitablePointFiles A list of filenames with point data.
  */
@@ -65,11 +104,573 @@ void specifySphereAndFindPoints(const std::vector<std::string>& suitablePointFil
 /**
  * @brief Calculates the average distance between all points in a collection of files.
  *
- * Iterates over provided files, reads the point data, and calculates the average distance between all points.
+ * Iterates over provided files and calculates the exact average distance between all points with the
+ * tiled, multithreaded AverageDistance kernel. With --approximate it is estimated from sampled pairs
+ * instead and printed with its 95% confidence interval.
  *
  * @param suitablePointFiles A list of filenames with point data.
  */
 void calculateAverageDistance(const std::vector<std::string>& suitablePointFiles);
+/**
+ * @brief Runs every analysis on each file from a single load, optionally with a sphere query.
+ *
+ * Each file is taken from the point cache once, and its bounding box, centroid, closest and
+ * farthest pairs, average distance and sphere hits are computed together with FullAnalysis,
+ * sharing the loaded points and the file's KD-tree. The user is asked whether to include a
+ * sphere query and, if so, for its center and diameter.
+ *
+ * @param suitablePointFiles A list of filenames with point data.
+ */
+void analyzeAllPoints(const std::vector<std::string>& suitablePointFiles);
+/**
+ * @brief Prompts for a tolerance, then reports the duplicated and near-duplicate points of each file.
+ *
+ * Every point is matched with DuplicateSearch against the earlier rows of its file that lie within
+ * the tolerance (0 finds exact duplicates only). The counts and the first duplicates are printed
+ * per file. With --results-dir a deduplicated copy of every file is written there as well.
+ *
+ * @param suitablePointFiles A list of filenames with point data.
+ */
+void findDuplicatePoints(const std::vector<std::string>& suitablePointFiles);
+/**
+ * @brief Prompts for a voxel size, then writes a downsampled copy of each file.
+ *
+ * The points of every occupied voxel are replaced by their centroid (with their average colour
+ * for RGB files) with VoxelGrid, and the reduction ratio and time are printed per file. Every
+ * file gets a <name>_voxel.pt in the --results-dir directory, or next to it when none is given,
+ * which option 1 accepts like any other point file.
+ *
+ * @param suitablePointFiles A list of filenames with point data.
+ */
+void downsamplePoints(const std::vector<std::string>& suitablePointFiles);
+
+void _printPair(const std::string &label, const Point &a, const Point &b, double distance)
+{
+    std::cout << label << ": (" << a.x << ", " << a.y << ", " << a.z
+              << ") and (" << b.x << ", " << b.y << ", " << b.z
+              << ") with distance " << distance << std::endl;
+}
+
+void _computeBounds(const PointCloud &points, Point &minPoint, Point &maxPoint)
+{
+    // Large clouds are reduced in chunks on the pool so one big file does not hold up the rest
+    const size_t chunkSize = 1 << 20;
+    const size_t chunks = (points.size() + chunkSize - 1) / chunkSize;
+    std::vector<Point> chunkMin(chunks), chunkMax(chunks);
+    ThreadPool::shared().parallelFor(chunks, [&](size_t chunk)
+    {
+        points.bounds(chunk * chunkSize, std::min(points.size(), (chunk + 1) * chunkSize), chunkMin[chunk], chunkMax[chunk]);
+    });
+
+    minPoint = Point{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    maxPoint = Point{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        minPoint.x = std::min(minPoint.x, chunkMin[chunk].x);
+        minPoint.y = std::min(minPoint.y, chunkMin[chunk].y);
+        minPoint.z = std::min(minPoint.z, chunkMin[chunk].z);
+        maxPoint.x = std::max(maxPoint.x, chunkMax[chunk].x);
+        maxPoint.y = std::max(maxPoint.y, chunkMax[chunk].y);
+        maxPoint.z = std::max(maxPoint.z, chunkMax[chunk].z);
+    }
+}
+
+bool _streamBounds(const std::string &filename, Point &minPoint, Point &maxPoint)
+{
+    minPoint = Point{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    maxPoint = Point{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    return PointStream::forEachChunk(filename, [&](const PointCloud &chunk, size_t)
+    {
+        Point low, high;
+        _computeBounds(chunk, low, high);
+        minPoint = Point{std::min(minPoint.x, low.x), std::min(minPoint.y, low.y), std::min(minPoint.z, low.z)};
+        maxPoint = Point{std::max(maxPoint.x, high.x), std::max(maxPoint.y, high.y), std::max(maxPoint.z, high.z)};
+    });
+}
+
+void _reportUnloaded(const std::string &filename)
+{
+    if (pointCache.exceedsBudget(filename))
+    {
+        std::cerr << "Error: File " << filename << " does not fit in the memory budget and will not be analyzed." << std::endl;
+        return;
+    }
+    std::cerr << "Could not open file: " << filename << std::endl;
+}
+
+void _reportOverBudget(const std::string &filename)
+{
+    // The file fit, but the working storage of the analysis did not
+    std::cerr << "Error: The analysis of " << filename << " does not fit in the memory budget." << std::endl;
+}
+
+void _printStorageError(const std::string &filename)
+{
+    // Compact storage trades precision for memory; say how much was given up
+    std::shared_ptr<const PointCloud> cloud = pointCache.storage() == PointCloud::Storage::Double ? nullptr : pointCache.get(filename);
+    if (cloud && cloud->storage() != PointCloud::Storage::Double)
+    {
+        std::cout << "Stored as " << PointCloud::storageName(cloud->storage()) << ", coordinates within "
+                  << cloud->maxError() << " of the file" << std::endl;
+    }
+}
+
+void _printPeakMemory()
+{
+    std::cout << "Peak resident memory: " << std::fixed << std::setprecision(1)
+              << PointStream::peakResidentBytes() / (1024.0 * 1024.0) << " MiB" << std::endl;
+    std::cout.unsetf(std::ios_base::fixed);
+    std::cout.precision(6);
+}
+
+void _printProfile()
+{
+    // The profile goes to stderr so the regular output stays unchanged
+    if (!Profiler::enabled())
+    {
+        return;
+    }
+    if (profileJson)
+    {
+        Profiler::printJson(std::cerr);
+    }
+    else
+    {
+        Profiler::printTable(std::cerr);
+    }
+    Profiler::reset();
+}
+
+std::string _resultPath(const std::string &filename, const std::string &suffix, const std::string &directory)
+{
+    // ./point_sets/scan.pt becomes <directory>/scan_<suffix>.pt
+    size_t slash = filename.find_last_of('/');
+    std::string stem = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+    if (Utils::checkFileExtension(stem))
+    {
+        stem.resize(stem.size() - 3);
+    }
+    return directory + "/" + stem + "_" + suffix + ".pt";
+}
+
+template <typename Producer>
+void _writeResultFile(ResultWriter &writer, const std::string &filename, const std::string &suffix,
+                      const std::string &description, Producer produce, const std::string &directory = resultsDirectory)
+{
+    // Results of an RGB file keep their colour
+    PointFileHeader header;
+    bool hasColor = PointLoader::readHeader(filename, header) && header.hasColor;
+    std::string path = _resultPath(filename, suffix, directory);
+    PointFileWriter file;
+    if (!file.open(path, hasColor, binaryResults))
+    {
+        writer.flush();
+        std::cerr << "Error opening output file: " << path << std::endl;
+        return;
+    }
+    produce(file);
+    if (!file.close())
+    {
+        writer.flush();
+        std::cerr << "Error writing output file: " << path << std::endl;
+        return;
+    }
+    if (file.count() == 0)
+    {
+        // An empty result is reported but leaves no file behind
+        writer.write("No " + description + ", so ").write(path).write(" was not written\n\n");
+        return;
+    }
+    writer.write("Wrote ").writeInteger(file.count()).write(" " + description + " to ").write(path).write("\n\n");
+}
+
+void _streamSphere(ResultWriter &writer, const std::string &filename, const Point &centre, double radius)
+{
+    // One chunk in memory at a time, hits go out as they are found
+    Profiler::Scope scope(filename, "sphere_query");
+    const double radiusSquared = radius * radius;
+    uint64_t hits = 0;
+    bool readOk = true, overBudget = false;
+    writer.write("File: ").write(filename).write('\n');
+    auto scan = [&](const std::function<void(const PointCloud &, size_t)> &onHit)
+    {
+        try
+        {
+            readOk = PointStream::forEachChunk(filename, [&](const PointCloud &chunk, size_t)
+            {
+                for (size_t i = 0; i < chunk.size(); ++i)
+                {
+                    double dx = chunk.xData()[i] - centre.x;
+                    double dy = chunk.yData()[i] - centre.y;
+                    double dz = chunk.zData()[i] - centre.z;
+                    if (dx * dx + dy * dy + dz * dz <= radiusSquared)
+                    {
+                        ++hits;
+                        onHit(chunk, i);
+                    }
+                }
+                Profiler::count(Profiler::DistanceEvaluations, chunk.size());
+            });
+        }
+        catch (const BudgetExceeded &)
+        {
+            overBudget = true;
+        }
+    };
+
+    if (!resultsDirectory.empty())
+    {
+        _writeResultFile(writer, filename, "sphere", "points inside the sphere", [&](PointFileWriter &file)
+        {
+            scan([&](const PointCloud &chunk, size_t i) { file.add(chunk[i], chunk.color(i)); });
+        });
+    }
+    else
+    {
+        writer.write("Points inside the sphere:\n");
+        scan([&](const PointCloud &chunk, size_t i) { writer.writePoint(chunk[i]); });
+        writer.write('\n');
+    }
+    writer.flush();
+    Profiler::count(Profiler::QueryHits, hits);
+    if (overBudget)
+    {
+        _reportOverBudget(filename);
+    }
+    else if (!readOk)
+    {
+        std::cerr << "Could not open file: " << filename << std::endl;
+    }
+}
+
+void _printReport(const PointCloud &points, const Point &low, const Point &high, const Point &centroid,
+                  const PointPair &closest, const PointPair &farthest, double averageDistance,
+                  const ApproximateDistance::AverageEstimate *estimate = nullptr, double farthestUpperBound = 0)
+{
+    ResultWriter writer(std::cout);
+    writer.write("Bounding box minimum: ").writePoint(low);
+    writer.write("Bounding box maximum: ").writePoint(high);
+    writer.write("Centroid: ").writePoint(centroid);
+    writer.flush();
+    if (closest.found)
+    {
+        _printPair("Closest points", points[closest.first], points[closest.second], closest.distance());
+        _printPair("Farthest points", points[farthest.first], points[farthest.second], farthest.distance());
+        if (farthestUpperBound > 0)
+        {
+            std::cout << "Farthest distance is at most " << farthestUpperBound << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "Not enough points to form a pair." << std::endl;
+    }
+    std::cout << "Average distance between points: " << std::fixed << std::setprecision(3) << averageDistance;
+    if (estimate != nullptr && !estimate->exact)
+    {
+        std::cout << " +/- " << estimate->halfWidth << " (95% confidence, " << estimate->samples << " sampled pairs)";
+    }
+    std::cout << std::endl;
+    std::cout.unsetf(std::ios_base::fixed);
+    std::cout.precision(6);
+}
+
+void _printDuplicates(const PointCloud &points, const DuplicateSearch::Result &result)
+{
+    const size_t kExamples = 10;
+    std::cout << "Exact duplicates: " << result.exactPoints << " points (" << result.exactPairs << " pairs)" << std::endl;
+    if (result.tolerance > 0)
+    {
+        std::cout << "Near duplicates within " << result.tolerance << ": " << result.nearPoints << " points ("
+                  << result.nearPairs << " pairs)" << std::endl;
+    }
+    for (size_t point : DuplicateSearch::firstDuplicates(points, result, kExamples))
+    {
+        const size_t match = result.match[point];
+        const Point a = points[point], b = points[match];
+        std::cout << "Point " << points.sourceIndex(point) << " (" << a.x << ", " << a.y << ", " << a.z << ")";
+        if (result.identical[point])
+        {
+            std::cout << " duplicates point " << points.sourceIndex(match) << std::endl;
+            continue;
+        }
+        double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+        std::cout << " is " << std::sqrt(dx * dx + dy * dy + dz * dz) << " from point " << points.sourceIndex(match)
+                  << std::endl;
+    }
+    if (result.duplicates() > kExamples)
+    {
+        std::cout << "... and " << result.duplicates() - kExamples << " more" << std::endl;
+    }
+}
+
+void _writeDeduplicatedPoints(PointFileWriter &file, const PointCloud &points, const std::vector<size_t> &kept)
+{
+    for (size_t point : kept)
+    {
+        file.add(points[point], points.color(point));
+    }
+}
+
+int _writeDeduplicated(const std::string &input, const std::string &output, double tolerance)
+{
+    // Rows are kept in file order unless they lie within the tolerance of a kept row
+    PointFileHeader header;
+    std::shared_ptr<const PointCloud> points = PointLoader::readHeader(input, header) ? pointCache.get(input) : nullptr;
+    if (!points)
+    {
+        _reportUnloaded(input);
+        return 1;
+    }
+    DuplicateSearch::Result result;
+    std::vector<size_t> kept;
+    try
+    {
+        Profiler::Scope scope(input, "duplicates");
+        if (!DuplicateSearch::find(*points, tolerance, result))
+        {
+            std::cerr << "Error: File " << input << " has too many points to deduplicate." << std::endl;
+            return 1;
+        }
+        kept = DuplicateSearch::keptPoints(*points, result);
+    }
+    catch (const BudgetExceeded &)
+    {
+        _reportOverBudget(input);
+        return 1;
+    }
+    std::cout << "File: " << input << std::endl;
+    _printDuplicates(*points, result);
+
+    PointFileWriter file;
+    bool written = file.open(output, header.hasColor, binaryResults);
+    if (written)
+    {
+        _writeDeduplicatedPoints(file, *points, kept);
+    }
+    if (!written || !file.close())
+    {
+        std::cerr << "Error writing output file: " << output << std::endl;
+        return 1;
+    }
+    if (file.count() == 0)
+    {
+        std::cout << "No deduplicated points, so " << output << " was not written" << std::endl;
+        return 0;
+    }
+    std::cout << "Wrote " << file.count() << " deduplicated points to " << output << std::endl;
+    return 0;
+}
+
+void _printDownsampled(const VoxelGrid::Result &result, double seconds)
+{
+    std::cout << "Downsampled " << result.inputPoints << " points to " << result.centroids.size()
+              << " voxel centroids (voxel size " << result.voxelSize << ", " << std::fixed << std::setprecision(1)
+              << result.reduction() << "x smaller) in " << std::setprecision(3) << seconds << " s" << std::endl;
+    std::cout.unsetf(std::ios_base::fixed);
+    std::cout.precision(6);
+}
+
+void _writeCentroids(PointFileWriter &file, const VoxelGrid::Result &result)
+{
+    const PointCloud &centroids = result.centroids;
+    for (size_t i = 0; i < centroids.size(); ++i)
+    {
+        file.add(centroids[i], centroids.color(i));
+    }
+}
+
+int _writeDownsampled(const std::string &input, const std::string &output, double voxelSize)
+{
+    PointFileHeader header;
+    std::shared_ptr<const PointCloud> points = PointLoader::readHeader(input, header) ? pointCache.get(input) : nullptr;
+    if (!points)
+    {
+        _reportUnloaded(input);
+        return 1;
+    }
+    VoxelGrid::Result result;
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        Profiler::Scope scope(input, "downsample");
+        if (!VoxelGrid::downsample(*points, voxelSize, result))
+        {
+            std::cerr << "Error: File " << input << " has too many points to downsample." << std::endl;
+            return 1;
+        }
+    }
+    catch (const BudgetExceeded &)
+    {
+        std::cerr << "Error: The downsampled points of " << input << " do not fit in the memory budget." << std::endl;
+        return 1;
+    }
+    std::cout << "File: " << input << std::endl;
+    _printDownsampled(result, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    PointFileWriter file;
+    bool written = file.open(output, header.hasColor, binaryResults);
+    if (written)
+    {
+        _writeCentroids(file, result);
+    }
+    if (!written || !file.close())
+    {
+        std::cerr << "Error writing output file: " << output << std::endl;
+        return 1;
+    }
+    if (file.count() == 0)
+    {
+        std::cout << "No voxel centroids, so " << output << " was not written" << std::endl;
+        return 0;
+    }
+    std::cout << "Wrote " << file.count() << " voxel centroids to " << output << std::endl;
+    return 0;
+}
+
+int _runServer(const std::string &socketPath)
+{
+    // Every suitable file is loaded and indexed once, then served until Ctrl+C
+    std::vector<std::string> files = getSuitablePointFiles();
+    std::vector<std::shared_ptr<const KDTree>> indexes(files.size());
+    ThreadPool::shared().parallelFor(files.size(), [&](size_t i)
+    {
+        indexes[i] = pointCache.getIndex(files[i]);
+    });
+
+    QueryServer server;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!indexes[i])
+        {
+            _reportUnloaded(files[i]);
+            continue;
+        }
+        server.add(files[i], indexes[i]);
+    }
+    _printProfile();
+
+    if (!server.listen(socketPath, std::cerr))
+    {
+        return 1;
+    }
+    std::signal(SIGINT, [](int) { QueryServer::stop(); });
+    std::signal(SIGTERM, [](int) { QueryServer::stop(); });
+    std::cout << "Serving " << server.fileCount() << " files on " << socketPath << ", press Ctrl+C to stop." << std::endl;
+    server.run();
+    _printProfile();
+    return 0;
+}
+
+int _runWatch()
+{
+    // Every file is reported once when loaded and again after each append, until Ctrl+C
+    const std::string directoryPath = "./point_sets";
+    PointWatcher watcher(directoryPath);
+    std::signal(SIGINT, [](int) { PointWatcher::stop(); });
+    auto report = [](const PointWatcher::FileState &state, size_t appended, double seconds)
+    {
+        const PointCloud &points = *state.cloud;
+        std::cout << "File: " << state.filename << " (+" << appended << " points, " << points.size()
+                  << " in total, updated in " << std::fixed << std::setprecision(3) << seconds << " s)" << std::endl;
+        std::cout.unsetf(std::ios_base::fixed);
+        std::cout.precision(6);
+        if (!points.empty())
+        {
+            _printReport(points, state.low, state.high, state.centroid(), state.closest, state.farthest,
+                         state.average.average());
+        }
+        std::cout << std::endl;
+        _printProfile();
+    };
+
+    try
+    {
+        watcher.loadAll(report);
+        std::cout << "Watching " << directoryPath << " for changes, press Ctrl+C to stop." << std::endl;
+        if (!watcher.run(report))
+        {
+            std::cerr << "Error watching directory: " << directoryPath << std::endl;
+            return 1;
+        }
+    }
+    catch (const BudgetExceeded &)
+    {
+        // The watcher keeps every file in memory, so it cannot stream around the budget
+        std::cerr << "Error: The watched files do not fit in the memory budget." << std::endl;
+        return 1;
+    }
+    std::cout << "Stopped watching." << std::endl;
+    return 0;
+}
+
+int _writeReordered(const std::string &input, const std::string &output, SpatialOrder::Curve curve)
+{
+    // Later runs read the points in curve order without sorting them again
+    PointFileHeader header;
+    PointCloud points;
+    try
+    {
+        if (!PointLoader::readHeader(input, header) || !PointLoader::loadPoints(input, points))
+        {
+            std::cerr << "Could not open file: " << input << std::endl;
+            return 1;
+        }
+        SpatialOrder::reorder(points, curve);
+    }
+    catch (const BudgetExceeded &)
+    {
+        std::cerr << "Error: File " << input << " does not fit in the memory budget and will not be reordered." << std::endl;
+        return 1;
+    }
+
+    PointFileWriter file;
+    bool written = file.open(output, header.hasColor, binaryResults);
+    for (size_t i = 0; written && i < points.size(); ++i)
+    {
+        file.add(points[i], points.color(i));
+    }
+    if (!written || !file.close())
+    {
+        std::cerr << "Error writing output file: " << output << std::endl;
+        return 1;
+    }
+    if (file.count() == 0)
+    {
+        std::cout << "No reordered points, so " << output << " was not written" << std::endl;
+        return 0;
+    }
+    std::cout << "Wrote " << file.count() << " reordered points to " << output << std::endl;
+    return 0;
+}
+
+bool _parseSize(const std::string &text, unsigned long long &value)
+{
+    // The whole argument must be digits, so "-1" is refused instead of wrapping around
+    const char *end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+double _parseNumber(const std::string &text)
+{
+    // NaN for anything but a complete number, so the callers' range checks reject it
+    double value;
+    const char *end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end ? value : std::numeric_limits<double>::quiet_NaN();
+}
+
+bool _parseMegabytes(const std::string &text, size_t &bytes)
+{
+    unsigned long long megabytes;
+    if (!_parseSize(text, megabytes) || megabytes > (std::numeric_limits<size_t>::max() >> 20))
+    {
+        return false;
+    }
+    bytes = static_cast<size_t>(megabytes) << 20;
+    return true;
+}
 
 bool _promptRepeatMenu()
 {
@@ -79,8 +680,245 @@ bool _promptRepeatMenu()
     return repeat == 'y' || repeat == 'Y';
 }
 
-int main()
-{
+int _runBatch(const std::string &queryFile, const std::string &outputFile, bool binary)
+{
+    std::vector<BatchQuery::Query> queries;
+    if (!BatchQuery::parseQueries(queryFile, queries, std::cerr))
+    {
+        return 1;
+    }
+    std::vector<std::string> files = getSuitablePointFiles();
+
+    if (outputFile.empty())
+    {
+        BatchQuery::run(files, queries, pointCache, std::cout, binary);
+        return 0;
+    }
+    std::ofstream out(outputFile, binary ? std::ios::binary : std::ios::out);
+    if (!out.is_open())
+    {
+        std::cerr << "Error opening output file: " << outputFile << std::endl;
+        return 1;
+    }
+    BatchQuery::run(files, queries, pointCache, out, binary);
+    return out.good() ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string batchFile, batchOutput, generateFile, reorderInput, reorderOutput, dedupInput, dedupOutput;
+    std::string downsampleInput, downsampleOutput, serveSocket;
+    double dedupTolerance = 0, voxelSize = 0;
+    SpatialOrder::Curve curve = SpatialOrder::Curve::None;
+    bool watchMode = false;
+    PointGenerator::Options generateOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--cache-mb" && i + 1 < argc)
+        {
+            // Amount of point data kept loaded between menu operations
+            size_t bytes;
+            if (!_parseMegabytes(argv[++i], bytes))
+            {
+                std::cerr << "Invalid cache size: " << argv[i] << std::endl;
+                return 1;
+            }
+            pointCache.setCapacity(bytes);
+        }
+        else if (option == "--memory-budget-mb" && i + 1 < argc)
+        {
+            // Upper bound on point and index storage; larger files are streamed or refused
+            size_t bytes;
+            if (!_parseMegabytes(argv[++i], bytes))
+            {
+                std::cerr << "Invalid memory budget: " << argv[i] << std::endl;
+                return 1;
+            }
+            MemoryBudget::setLimit(bytes);
+        }
+        else if (option == "--storage" && i + 1 < argc)
+        {
+            // How cached clouds keep their coordinates
+            PointCloud::Storage storage;
+            if (!PointCloud::parseStorage(argv[++i], storage))
+            {
+                std::cerr << "Unknown storage: " << argv[i] << std::endl;
+                return 1;
+            }
+            pointCache.setStorage(storage);
+        }
+        else if (option == "--reorder" && i + 1 < argc)
+        {
+            // Space-filling curve the cached clouds are sorted along
+            if (!SpatialOrder::parseCurve(argv[++i], curve))
+            {
+                std::cerr << "Unknown curve: " << argv[i] << std::endl;
+                return 1;
+            }
+            pointCache.setReorder(curve);
+        }
+        else if (option == "--write-reordered" && i + 2 < argc)
+        {
+            reorderInput = argv[++i];
+            reorderOutput = argv[++i];
+        }
+        else if (option == "--deduplicate" && i + 3 < argc)
+        {
+            dedupInput = argv[++i];
+            dedupOutput = argv[++i];
+            dedupTolerance = _parseNumber(argv[++i]);
+            if (!(dedupTolerance >= 0))
+            {
+                std::cerr << "Invalid tolerance: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--downsample" && i + 3 < argc)
+        {
+            downsampleInput = argv[++i];
+            downsampleOutput = argv[++i];
+            voxelSize = _parseNumber(argv[++i]);
+            if (!(voxelSize > 0))
+            {
+                std::cerr << "Invalid voxel size: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--approximate" && i + 1 < argc)
+        {
+            // Trade exactness for speed on the average distance and farthest pair
+            approximateTolerance = _parseNumber(argv[++i]);
+            if (!(approximateTolerance >= 0))
+            {
+                std::cerr << "Invalid tolerance: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--serve" && i + 1 < argc)
+        {
+            serveSocket = argv[++i];
+        }
+        else if (option == "--watch")
+        {
+            watchMode = true;
+        }
+        else if (option == "--stream")
+        {
+            streamingMode = true;
+        }
+        else if (option == "--profile" || option == "--profile-json")
+        {
+            Profiler::setEnabled(true);
+            profileJson = option == "--profile-json";
+        }
+        else if (option == "--results-dir" && i + 1 < argc)
+        {
+            resultsDirectory = argv[++i];
+        }
+        else if (option == "--batch" && i + 1 < argc)
+        {
+            batchFile = argv[++i];
+        }
+        else if (option == "--out" && i + 1 < argc)
+        {
+            batchOutput = argv[++i];
+        }
+        else if (option == "--binary")
+        {
+            binaryResults = true;
+        }
+        else if (option == "--generate" && i + 2 < argc)
+        {
+            generateFile = argv[++i];
+            unsigned long long count;
+            if (!_parseSize(argv[++i], count))
+            {
+                std::cerr << "Invalid point count: " << argv[i] << std::endl;
+                return 1;
+            }
+            generateOptions.count = static_cast<size_t>(count);
+        }
+        else if (option == "--distribution" && i + 1 < argc)
+        {
+            if (!PointGenerator::parseDistribution(argv[++i], generateOptions.distribution))
+            {
+                std::cerr << "Unknown distribution: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--rgb")
+        {
+            generateOptions.withColor = true;
+        }
+        else if (option == "--seed" && i + 1 < argc)
+        {
+            unsigned long long seed;
+            if (!_parseSize(argv[++i], seed))
+            {
+                std::cerr << "Invalid seed: " << argv[i] << std::endl;
+                return 1;
+            }
+            generateOptions.seed = seed;
+        }
+        else if (option == "--convert" && i + 2 < argc)
+        {
+            if (!BinaryPointFile::convertFromAscii(argv[i + 1], argv[i + 2]))
+            {
+                std::cerr << "Error converting " << argv[i + 1] << " to binary." << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote binary point file: " << argv[i + 2] << std::endl;
+            return 0;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+    if (!generateFile.empty())
+    {
+        generateOptions.binary = binaryResults;
+        if (!PointGenerator::write(generateFile, generateOptions))
+        {
+            std::cerr << "Error generating " << generateFile << "." << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << generateOptions.count << " points to " << generateFile << std::endl;
+        return 0;
+    }
+    if (!reorderOutput.empty())
+    {
+        return _writeReordered(reorderInput, reorderOutput, curve == SpatialOrder::Curve::None ? SpatialOrder::Curve::Morton : curve);
+    }
+    if (!dedupOutput.empty())
+    {
+        int status = _writeDeduplicated(dedupInput, dedupOutput, dedupTolerance);
+        _printProfile();
+        return status;
+    }
+    if (!downsampleOutput.empty())
+    {
+        int status = _writeDownsampled(downsampleInput, downsampleOutput, voxelSize);
+        _printProfile();
+        return status;
+    }
+    if (!serveSocket.empty())
+    {
+        return _runServer(serveSocket);
+    }
+    if (watchMode)
+    {
+        return _runWatch();
+    }
+    if (!batchFile.empty())
+    {
+        int status = _runBatch(batchFile, batchOutput, binaryResults);
+        _printProfile();
+        return status;
+    }
+
     int choice = -1;
 
     std::vector<std::string> suitableFiles;
@@ -93,6 +931,9 @@ int main()
                   << "3. Identify corner points of the smallest cube for all points\n"
                   << "4. Specify sphere and find points within sphere\n"
                   << "5. Calculate average distance between points\n"
+                  << "6. Analyze all (every analysis from a single load)\n"
+                  << "7. Find duplicate and near-duplicate points\n"
+                  << "8. Downsample points to a voxel grid\n"
                   << "9. Exit\n"
                   << "Enter your choice: ";
         std::cin >> choice;
@@ -103,10 +944,14 @@ int main()
             listFiles();
             break;
         case 1:
-            suitableFiles = getSuitablePointFiles();
+            suitableFiles = getSuitablePointFiles(!streamingMode);
             for (const std::string &filePath : suitableFiles)
             {
                 std::cout << "Suitable file: " << filePath << std::endl;
+                if (!streamingMode)
+                {
+                    _printStorageError(filePath);
+                }
             }
 
             break;
@@ -122,12 +967,22 @@ int main()
         case 5:
             calculateAverageDistance(suitableFiles);
             break;
+        case 6:
+            analyzeAllPoints(suitableFiles);
+            break;
+        case 7:
+            findDuplicatePoints(suitableFiles);
+            break;
+        case 8:
+            downsamplePoints(suitableFiles);
+            break;
         case 9:
             std::cout << "Exiting the program." << std::endl;
             return 0; // Exit the program immediately
         default:
             std::cout << "Invalid choice. Please try again." << std::endl;
         }
+        _printProfile();
     } while (_promptRepeatMenu()); // This will repeat the menu if the user wants to
 
     return 0;
@@ -156,7 +1011,109 @@ void listFiles()
     closedir(dir);
 }
 
-std::vector<std::string> getSuitablePointFiles()
+bool _validatePointFile(const std::string &directoryPath, const std::string &filename, std::ostream &errors)
+{
+    std::ifstream file(directoryPath + std::string("/") + filename);
+    if (!file.is_open())
+    {
+        errors << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineCount = 0, pointCount = 0;
+    bool validHeader = true, binaryData = false;
+    while (getline(file, line) && lineCount < 4)
+    {
+        switch (lineCount)
+        {
+        case 0:
+            if (!utils.checkVersion(line))
+            {
+                errors << "Error in file " << filename << ": Invalid version format." << std::endl;
+                validHeader = false;
+            }
+            break;
+        case 1:
+            if (!utils.checkFormat(line))
+            {
+                errors << "Error in file " << filename << ": Invalid format, should be 'x y z' or 'x y z r g b'." << std::endl;
+                validHeader = false;
+            }
+            break;
+        case 2:
+            if (!utils.checkPointsCount(line, pointCount))
+            {
+                errors << "Error in file " << filename << ": Invalid points count." << std::endl;
+                validHeader = false;
+            }
+            break;
+        case 3:
+            if (!utils.checkData(line))
+            {
+                errors << "Error in file " << filename << ": Data type must be 'ascii' or 'binary'." << std::endl;
+                validHeader = false;
+            }
+            binaryData = utils.isBinaryData(line);
+            break;
+        }
+        if (!validHeader)
+        {
+            break;
+        }
+        lineCount++;
+    }
+
+    if (!validHeader)
+    {
+        file.close();
+        return false;
+    }
+
+    if (binaryData)
+    {
+        // A binary data section is checked by its size instead of by counting rows
+        file.close();
+        std::string filePath = directoryPath + std::string("/") + filename;
+        PointFileHeader header;
+        struct stat info;
+        if (PointLoader::readHeader(filePath, header) && stat(filePath.c_str(), &info) == 0 &&
+            BinaryPointFile::hasExpectedSize(header, static_cast<size_t>(info.st_size)))
+        {
+            return true;
+        }
+        errors << "Error in file " << filename << ": Binary data size does not match the points count." << std::endl;
+        return false;
+    }
+
+    // Check every row against the FORMAT line, then the number of rows against the header
+    file.close();
+    std::string filePath = directoryPath + std::string("/") + filename;
+    PointFileHeader header;
+    ValidationReport report;
+    if (!PointLoader::readHeader(filePath, header) || !PointValidator::validateRows(filePath, header, report))
+    {
+        errors << "Error reading file: " << filename << std::endl;
+        return false;
+    }
+    for (const ValidationError &error : report.errors)
+    {
+        errors << "Error in file " << filename << ":" << error.line << ":" << error.column << ": " << error.message << std::endl;
+    }
+    if (report.errorCount > report.errors.size())
+    {
+        errors << "Error in file " << filename << ": " << report.errorCount - report.errors.size() << " more invalid rows." << std::endl;
+    }
+    if (report.rowCount != static_cast<size_t>(pointCount))
+    {
+        errors << "Error in file " << filename << ": Points count " << pointCount << " does not match the "
+               << report.rowCount << " data rows." << std::endl;
+        return false;
+    }
+    return report.valid();
+}
+
+std::vector<std::string> getSuitablePointFiles(bool warmCache)
 {
     const char *directoryPath = "./point_sets";
     std::vector<std::string> suitableFiles;
@@ -167,111 +1124,50 @@ std::vector<std::string> getSuitablePointFiles()
         return suitableFiles;
     }
 
+    std::vector<std::string> filenames;
     dirent *entry;
     while ((entry = readdir(dir)) != nullptr)
     {
-        std::string filename(entry->d_name);
-        if (filename[0] != '.' && utils.checkFileExtension(filename))
+        if (entry->d_name[0] != '.')
         {
-            std::ifstream file(directoryPath + std::string("/") + filename);
-            if (!file.is_open())
-            {
-                std::cerr << "Error opening file: " << filename << std::endl;
-                continue;
-            }
-
-            std::string line;
-            int lineCount = 0, pointCount = 0;
-            bool validHeader = true;
-            while (getline(file, line) && lineCount < 4)
-            {
-                switch (lineCount)
-                {
-                case 0:
-                    if (!utils.checkVersion(line))
-                    {
-                        std::cerr << "Error in file " << filename << ": Invalid version format." << std::endl;
-                        validHeader = false;
-                    }
-                    break;
-                case 1:
-                    if (!utils.checkFormat(line))
-                    {
-                        std::cerr << "Error in file " << filename << ": Invalid format, should be 'x y z' or 'x y z r g b'." << std::endl;
-                        validHeader = false;
-                    }
-                    break;
-                case 2:
-                    if (!utils.checkPointsCount(line, pointCount))
-                    {
-                        std::cerr << "Error in file " << filename << ": Invalid points count." << std::endl;
-                        validHeader = false;
-                    }
-                    break;
-                case 3:
-                    if (!utils.checkData(line))
-                    {
-                        std::cerr << "Error in file " << filename << ": Data type must be 'ascii'." << std::endl;
-                        validHeader = false;
-                    }
-                    break;
-                }
-                if (!validHeader)
-                {
-                    break;
-                }
-                lineCount++;
-            }
-
-            if (!validHeader)
-            {
-                file.close();
-                continue;
-            }
+            filenames.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
 
-            // Check if the number of points matches the count specified in the header
-            std::string pointLine;
-            int actualPointsCount = 0;
-            while (getline(file, pointLine) || !file.eof())
+    // Validate all files concurrently, then report in directory order
+    std::vector<std::string> errors(filenames.size());
+    std::vector<char> suitable(filenames.size(), 0);
+    ThreadPool::shared().parallelFor(filenames.size(), [&](size_t i)
+    {
+        std::ostringstream fileErrors;
+        if (!utils.checkFileExtension(filenames[i]))
+        {
+            fileErrors << "Error: File " << filenames[i] << " does not have a .pt extension and will not be analyzed." << std::endl;
+        }
+        else
+        {
+            const std::string filePath = directoryPath + std::string("/") + filenames[i];
             {
-                if (file.fail() && !file.eof())
-                {
-                    std::cerr << "Error reading file: " << filename << std::endl;
-                    validHeader = false;
-                    break;
-                }
-
-                if (!pointLine.empty() && !file.eof())
-                {
-                    actualPointsCount++;
-                }
-                else if (file.eof())
-                {
-                    // Handle the last line if it did not end with a newline
-                    std::istringstream iss(pointLine);
-                    std::string point;
-                    if (iss >> point)
-                    { // Check if there's at least one value in the last line
-                        actualPointsCount++;
-                    }
-                    break;
-                }
+                Profiler::Scope scope(filePath, "validate");
+                suitable[i] = _validatePointFile(directoryPath, filenames[i], fileErrors);
             }
-
-            file.close();
-
-            if (actualPointsCount == pointCount)
+            if (suitable[i] && warmCache)
             {
-                suitableFiles.push_back(directoryPath + std::string("/") + filename);
+                pointCache.get(filePath);
             }
         }
-        else if (filename[0] != '.')
+        errors[i] = fileErrors.str();
+    });
+
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        std::cerr << errors[i];
+        if (suitable[i])
         {
-            std::cerr << "Error: File " << filename << " does not have a .pt extension and will not be analyzed." << std::endl;
+            suitableFiles.push_back(directoryPath + std::string("/") + filenames[i]);
         }
     }
-
-    closedir(dir);
     return suitableFiles;
 }
 
@@ -279,111 +1175,166 @@ void checkClosestAndFarthestPoints(const std::vector<std::string> &files)
 {
     double maxDistance = std::numeric_limits<double>::min();
     double minDistance = std::numeric_limits<double>::max();
+    double maxUpperBound = 0;
     Point maxPointA, maxPointB, minPointA, minPointB;
 
-    for (const std::string &filename : files)
+    // Search all files concurrently; results are printed and merged in file order
+    std::vector<std::shared_ptr<const PointCloud>> clouds(files.size());
+    std::vector<PointPair> closestPairs(files.size()), farthestPairs(files.size());
+    std::vector<double> upperBounds(files.size(), 0);
+    std::vector<char> overBudget(files.size(), 0);
+    ThreadPool::shared().parallelFor(files.size(), [&](size_t i)
     {
-        std::ifstream file(filename);
-        if (!file.is_open())
+        clouds[i] = pointCache.get(files[i]);
+        if (!clouds[i])
         {
-            std::cerr << "Could not open file: " << filename << std::endl;
-            continue;
+            return;
         }
-
-        std::vector<Point> points;
-        std::string line;
-        while (getline(file, line))
+        try
         {
-            std::istringstream iss(line);
-            Point p;
-            if (iss >> p.x >> p.y >> p.z)
             {
-                points.push_back(p);
-                // Skip the rest of the line in case there are RGB values or other extra data
-                iss.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                Profiler::Scope scope(files[i], "closest_pair");
+                closestPairs[i] = PairSearch::inSourceOrder(*clouds[i], PairSearch::closestPair(*clouds[i]));
+            }
+            if (approximateTolerance > 0)
+            {
+                Profiler::Scope scope(files[i], "farthest_estimate");
+                ApproximateDistance::DiameterEstimate estimate = ApproximateDistance::diameter(*clouds[i], approximateTolerance);
+                farthestPairs[i] = PairSearch::inSourceOrder(*clouds[i], estimate.pair);
+                upperBounds[i] = estimate.upperBound;
+                return;
             }
+            Profiler::Scope scope(files[i], "farthest_pair");
+            farthestPairs[i] = PairSearch::inSourceOrder(*clouds[i], PairSearch::farthestPair(*clouds[i]));
         }
-        file.close();
+        catch (const BudgetExceeded &)
+        {
+            overBudget[i] = 1;
+        }
+    });
 
-        // Calculate distances between all pairs of points
-        for (size_t i = 0; i < points.size(); ++i)
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const std::string &filename = files[i];
+        if (!clouds[i])
         {
-            for (size_t j = i + 1; j < points.size(); ++j)
-            {
-                double distance = points[i].distanceTo(points[j]);
-                if (distance < minDistance)
-                {
-                    minDistance = distance;
-                    minPointA = points[i];
-                    minPointB = points[j];
-                }
-                if (distance > maxDistance)
-                {
-                    maxDistance = distance;
-                    maxPointA = points[i];
-                    maxPointB = points[j];
-                }
-            }
+            _reportUnloaded(filename);
+            continue;
+        }
+        if (overBudget[i])
+        {
+            _reportOverBudget(filename);
+            continue;
+        }
+        Profiler::Scope scope(filename, "print");
+        const PointCloud &points = *clouds[i];
+        const PointPair &closest = closestPairs[i];
+        const PointPair &farthest = farthestPairs[i];
+
+        std::cout << "File: " << filename << std::endl;
+        if (!closest.found)
+        {
+            std::cout << "Not enough points to form a pair." << std::endl << std::endl;
+            continue;
+        }
+        _printPair("Closest points", points[closest.first], points[closest.second], closest.distance());
+        _printPair("Farthest points", points[farthest.first], points[farthest.second], farthest.distance());
+        if (approximateTolerance > 0)
+        {
+            std::cout << "Farthest distance is at most " << upperBounds[i] << std::endl;
+        }
+        std::cout << std::endl;
+
+        // Merge into the answer over all files, earlier files win ties
+        if (closest.distance() < minDistance)
+        {
+            minDistance = closest.distance();
+            minPointA = points[closest.first];
+            minPointB = points[closest.second];
+        }
+        if (farthest.distance() > maxDistance)
+        {
+            maxDistance = farthest.distance();
+            maxPointA = points[farthest.first];
+            maxPointB = points[farthest.second];
         }
+        maxUpperBound = std::max(maxUpperBound, upperBounds[i]);
     }
 
     // Output the results
-    std::cout << "Closest points: (" << minPointA.x << ", " << minPointA.y << ", " << minPointA.z
-              << ") and (" << minPointB.x << ", " << minPointB.y << ", " << minPointB.z
-              << ") with distance " << minDistance << std::endl;
-
-    std::cout << "Farthest points: (" << maxPointA.x << ", " << maxPointA.y << ", " << maxPointA.z
-              << ") and (" << maxPointB.x << ", " << maxPointB.y << ", " << maxPointB.z
-              << ") with distance " << maxDistance << std::endl;
+    std::cout << "All files:" << std::endl;
+    _printPair("Closest points", minPointA, minPointB, minDistance);
+    _printPair("Farthest points", maxPointA, maxPointB, maxDistance);
+    if (approximateTolerance > 0)
+    {
+        std::cout << "Farthest distance is at most " << maxUpperBound << std::endl;
+    }
 }
 
 void identifyCornerPoints(const std::vector<std::string>& files) {
-    for (const std::string& filename : files) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
+    // Compute all boxes concurrently, print them in file order
+    std::vector<char> loaded(files.size(), 0), overBudget(files.size(), 0);
+    std::vector<Point> minPoints(files.size()), maxPoints(files.size());
+    ThreadPool::shared().parallelFor(files.size(), [&](size_t i) {
+        std::shared_ptr<const PointCloud> cachedPoints = streamingMode ? nullptr : pointCache.get(files[i]);
+        if (cachedPoints) {
+            Profiler::Scope scope(files[i], "bounding_box");
+            _computeBounds(*cachedPoints, minPoints[i], maxPoints[i]);
+            loaded[i] = 1;
+        } else if (streamingMode || pointCache.exceedsBudget(files[i])) {
+            // Files over the memory budget are streamed instead
+            Profiler::Scope scope(files[i], "bounding_box");
+            try {
+                loaded[i] = _streamBounds(files[i], minPoints[i], maxPoints[i]);
+            } catch (const BudgetExceeded&) {
+                overBudget[i] = 1;
+            }
+        }
+    });
+
+    ResultWriter writer(std::cout);
+    for (size_t i = 0; i < files.size(); ++i) {
+        const std::string& filename = files[i];
+        if (overBudget[i]) {
+            writer.flush();
+            _reportOverBudget(filename);
+            continue;
+        }
+        if (!loaded[i]) {
+            writer.flush();
             std::cerr << "Could not open file: " << filename << std::endl;
             continue;
         }
+        Profiler::Scope scope(filename, "print");
+        const Point& minPoint = minPoints[i];
+        const Point& maxPoint = maxPoints[i];
+        const Point corners[8] = {
+            {minPoint.x, minPoint.y, minPoint.z}, {maxPoint.x, minPoint.y, minPoint.z},
+            {minPoint.x, maxPoint.y, minPoint.z}, {maxPoint.x, maxPoint.y, minPoint.z},
+            {minPoint.x, minPoint.y, maxPoint.z}, {maxPoint.x, minPoint.y, maxPoint.z},
+            {minPoint.x, maxPoint.y, maxPoint.z}, {maxPoint.x, maxPoint.y, maxPoint.z}};
 
-        Point minPoint{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
-        Point maxPoint{std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
-
-        std::string line;
-        while (getline(file, line)) {
-            if (!utils.isHeaderLine(line)) { // Skip header lines
-                std::istringstream iss(line);
-                Point point;
-                if (iss >> point.x >> point.y >> point.z) {
-                    minPoint.x = std::min(minPoint.x, point.x);
-                    minPoint.y = std::min(minPoint.y, point.y);
-                    minPoint.z = std::min(minPoint.z, point.z);
-                    maxPoint.x = std::max(maxPoint.x, point.x);
-                    maxPoint.y = std::max(maxPoint.y, point.y);
-                    maxPoint.z = std::max(maxPoint.z, point.z);
+        writer.write("File: ").write(filename).write('\n');
+        if (!resultsDirectory.empty()) {
+            _writeResultFile(writer, filename, "corners", "corner points", [&](PointFileWriter& file) {
+                for (const Point& corner : corners) {
+                    file.add(corner);
                 }
-            }
+            });
+            continue;
         }
-        file.close();
 
-        // Set the precision for floating-point values to three decimal places
-        std::cout << std::fixed << std::setprecision(3);
-
-        // Output the results for this file
-        std::cout << "File: " << filename << std::endl;
-        std::cout << "Smallest cube corner points:" << std::endl;
-        std::cout << "(" << minPoint.x << ", " << minPoint.y << ", " << minPoint.z << ")" << std::endl;
-        std::cout << "(" << maxPoint.x << ", " << minPoint.y << ", " << minPoint.z << ")" << std::endl;
-        std::cout << "(" << minPoint.x << ", " << maxPoint.y << ", " << minPoint.z << ")" << std::endl;
-        std::cout << "(" << maxPoint.x << ", " << maxPoint.y << ", " << minPoint.z << ")" << std::endl;
-        std::cout << "(" << minPoint.x << ", " << minPoint.y << ", " << maxPoint.z << ")" << std::endl;
-        std::cout << "(" << maxPoint.x << ", " << minPoint.y << ", " << maxPoint.z << ")" << std::endl;
-        std::cout << "(" << minPoint.x << ", " << maxPoint.y << ", " << maxPoint.z << ")" << std::endl;
-        std::cout << "(" << maxPoint.x << ", " << maxPoint.y << ", " << maxPoint.z << ")" << std::endl;
-        std::cout << std::endl;
+        // Output the results for this file with three decimal places
+        writer.write("Smallest cube corner points:\n");
+        for (const Point& corner : corners) {
+            writer.writePoint(corner);
+        }
+        writer.write('\n');
+    }
+    writer.flush();
 
-        // Reset the precision if needed elsewhere with default behavior
-        std::cout.unsetf(std::ios_base::fixed);
-        std::cout.precision(6);
+    if (streamingMode) {
+        _printPeakMemory();
     }
 }
 
@@ -399,37 +1350,108 @@ void specifySphereAndFindPoints(const std::vector<std::string>& suitablePointFil
     std::cin >> diameter;
     radius = diameter / 2.0;
 
-    for (const std::string& filename : suitablePointFiles) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
+    if (streamingMode) {
+        // One file at a time so only a single chunk is in memory
+        ResultWriter writer(std::cout);
+        for (const std::string& filename : suitablePointFiles) {
+            _streamSphere(writer, filename, sphereCenter, radius);
+        }
+        _printPeakMemory();
+        return;
+    }
+
+    // Query all files concurrently, print them in file order
+    std::vector<std::shared_ptr<const KDTree>> indexes(suitablePointFiles.size());
+    std::vector<std::vector<size_t>> fileHits(suitablePointFiles.size());
+    ThreadPool::shared().parallelFor(suitablePointFiles.size(), [&](size_t i) {
+        indexes[i] = pointCache.getIndex(suitablePointFiles[i]);
+        if (indexes[i]) {
+            // Report hits in file order, the tree returns them in tree order
+            Profiler::Scope scope(suitablePointFiles[i], "sphere_query");
+            indexes[i]->sphereQuery(sphereCenter, radius, fileHits[i]);
+            indexes[i]->cloud().sortBySource(fileHits[i]);
+            Profiler::count(Profiler::QueryHits, fileHits[i].size());
+        }
+    });
+
+    ResultWriter writer(std::cout);
+    for (size_t i = 0; i < suitablePointFiles.size(); ++i) {
+        const std::string& filename = suitablePointFiles[i];
+        const std::shared_ptr<const KDTree>& index = indexes[i];
+        if (!index && pointCache.exceedsBudget(filename)) {
+            // Too large to index within the memory budget, so scan it chunk by chunk
+            _streamSphere(writer, filename, sphereCenter, radius);
+            continue;
+        }
+        if (!index) {
+            writer.flush();
             std::cerr << "Could not open file: " << filename << std::endl;
             continue;
         }
 
-        std::string line;
-        std::vector<Point> pointsInsideSphere;
-        while (getline(file, line)) {
-            if (!utils.isHeaderLine(line)) { // Skip header lines
-                std::istringstream iss(line);
-                Point point;
-                if (iss >> point.x >> point.y >> point.z) {
-                    // Check if the point is inside the sphere
-                    if (point.distanceTo(sphereCenter) <= radius) {
-                        pointsInsideSphere.push_back(point);
-                    }
+        Profiler::Scope scope(filename, "print");
+        const PointCloud& cloud = index->cloud();
+        writer.write("File: ").write(filename).write('\n');
+        if (!resultsDirectory.empty()) {
+            _writeResultFile(writer, filename, "sphere", "points inside the sphere", [&](PointFileWriter& file) {
+                for (size_t hit : fileHits[i]) {
+                    file.add(cloud[hit], cloud.color(hit));
                 }
+            });
+            continue;
+        }
+
+        // Print out the points inside the sphere for this file with three decimal places
+        writer.write("Points inside the sphere:\n");
+        for (size_t hit : fileHits[i]) {
+            writer.writePoint(cloud[hit]);
+        }
+        writer.write('\n');
+    }
+    writer.flush();
+}
+
+void calculateAverageDistance(const std::vector<std::string>& suitablePointFiles) {
+    // Files run concurrently and each file's tiles are spread over the same pool
+    std::vector<char> loaded(suitablePointFiles.size(), 0), overBudget(suitablePointFiles.size(), 0);
+    std::vector<ApproximateDistance::AverageEstimate> averages(suitablePointFiles.size());
+    ThreadPool::shared().parallelFor(suitablePointFiles.size(), [&](size_t i) {
+        std::shared_ptr<const PointCloud> cachedPoints = pointCache.get(suitablePointFiles[i]);
+        loaded[i] = cachedPoints != nullptr;
+        try {
+            if (cachedPoints && approximateTolerance > 0) {
+                Profiler::Scope scope(suitablePointFiles[i], "average_estimate");
+                averages[i] = ApproximateDistance::average(*cachedPoints, approximateTolerance);
+            } else if (cachedPoints) {
+                Profiler::Scope scope(suitablePointFiles[i], "average_distance");
+                averages[i].average = AverageDistance::compute(*cachedPoints).average();
             }
+        } catch (const BudgetExceeded&) {
+            overBudget[i] = 1;
         }
-        file.close();
+    });
+
+    for (size_t i = 0; i < suitablePointFiles.size(); ++i) {
+        const std::string& filename = suitablePointFiles[i];
+        if (!loaded[i]) {
+            _reportUnloaded(filename);
+            continue;
+        }
+        if (overBudget[i]) {
+            _reportOverBudget(filename);
+            continue;
+        }
+        Profiler::Scope scope(filename, "print");
+        const ApproximateDistance::AverageEstimate& average = averages[i];
 
-        // Print out the points inside the sphere for this file
+        // Print out the average distance for this file
         std::cout << "File: " << filename << std::endl;
-        std::cout << "Points inside the sphere:" << std::endl;
-        for (const auto& point : pointsInsideSphere) {
-            std::cout << std::fixed << std::setprecision(3);
-            std::cout << "(" << point.x << ", " << point.y << ", " << point.z << ")" << std::endl;
+        std::cout << "Average distance between points: " << std::fixed << std::setprecision(3) << average.average;
+        if (approximateTolerance > 0 && !average.exact) {
+            std::cout << " +/- " << average.halfWidth << " (95% confidence, " << average.samples << " sampled pairs)";
         }
         std::cout << std::endl;
+        std::cout << std::endl;
 
         // Reset the precision if needed elsewhere with default behavior
         std::cout.unsetf(std::ios_base::fixed);
@@ -437,49 +1459,195 @@ void specifySphereAndFindPoints(const std::vector<std::string>& suitablePointFil
     }
 }
 
-void calculateAverageDistance(const std::vector<std::string>& suitablePointFiles) {
-    for (const std::string& filename : suitablePointFiles) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Could not open file: " << filename << std::endl;
+void analyzeAllPoints(const std::vector<std::string>& suitablePointFiles) {
+    char withSphere;
+    FullAnalysis::Sphere sphere;
+    std::cout << "Include a sphere query? (y/n): ";
+    std::cin >> withSphere;
+    bool querySphere = withSphere == 'y' || withSphere == 'Y';
+    if (querySphere) {
+        double diameter;
+        std::cout << "Enter the center of the sphere (x y z): ";
+        std::cin >> sphere.centre.x >> sphere.centre.y >> sphere.centre.z;
+        std::cout << "Enter the diameter of the sphere: ";
+        std::cin >> diameter;
+        sphere.radius = diameter / 2.0;
+    }
+
+    // Analyze all files concurrently, print them in file order
+    std::vector<std::shared_ptr<const PointCloud>> clouds(suitablePointFiles.size());
+    std::vector<FullAnalysis::Result> results(suitablePointFiles.size());
+    std::vector<char> overBudget(suitablePointFiles.size(), 0);
+    ThreadPool::shared().parallelFor(suitablePointFiles.size(), [&](size_t i) {
+        // The tree is built over the cached cloud and shared by the pair searches and the sphere query
+        std::shared_ptr<const KDTree> index = pointCache.getIndex(suitablePointFiles[i]);
+        clouds[i] = index ? index->sharedCloud() : nullptr;
+        try {
+            if (index) {
+                results[i] = FullAnalysis::analyze(suitablePointFiles[i], *index, querySphere ? &sphere : nullptr,
+                                                   approximateTolerance);
+            }
+        } catch (const BudgetExceeded&) {
+            overBudget[i] = 1;
+        }
+    });
+
+    for (size_t i = 0; i < suitablePointFiles.size(); ++i) {
+        const std::string& filename = suitablePointFiles[i];
+        if (!clouds[i]) {
+            _reportUnloaded(filename);
+            continue;
+        }
+        if (overBudget[i]) {
+            _reportOverBudget(filename);
             continue;
         }
+        Profiler::Scope scope(filename, "print");
+        const PointCloud& points = *clouds[i];
+        const FullAnalysis::Result& result = results[i];
 
-        std::string line;
-        std::vector<Point> points;
-        while (getline(file, line)) {
-            if (!utils.isHeaderLine(line)) { // Skip header lines
-                std::istringstream iss(line);
-                Point point;
-                if (iss >> point.x >> point.y >> point.z) {
-                    points.push_back(point);
-                }
-            }
+        std::cout << "File: " << filename << std::endl;
+        std::cout << "Points: " << points.size() << std::endl;
+        if (points.empty()) {
+            std::cout << std::endl;
+            continue;
         }
-        file.close();
+        _printReport(points, result.low, result.high, result.centroid, result.closest, result.farthest,
+                     result.average.average, &result.average, result.farthestUpperBound);
+        ResultWriter writer(std::cout);
 
-        // Now calculate the average distance between all points
-        double totalDistance = 0;
-        int count = 0;
-        for (size_t i = 0; i < points.size(); ++i) {
-            for (size_t j = i + 1; j < points.size(); ++j) {
-                totalDistance += points[i].distanceTo(points[j]);
-                ++count;
+        if (querySphere) {
+            if (!resultsDirectory.empty()) {
+                _writeResultFile(writer, filename, "sphere", "points inside the sphere", [&](PointFileWriter& file) {
+                    for (size_t hit : result.sphereHits) {
+                        file.add(points[hit], points.color(hit));
+                    }
+                });
+                writer.flush();
+                continue;
+            }
+            writer.write("Points inside the sphere:\n");
+            for (size_t hit : result.sphereHits) {
+                writer.writePoint(points[hit]);
             }
         }
+        writer.write('\n');
+        writer.flush();
+    }
+}
+
+void findDuplicatePoints(const std::vector<std::string>& suitablePointFiles) {
+    double tolerance;
+    std::cout << "Enter the tolerance (0 for exact duplicates only): ";
+    std::cin >> tolerance;
+    if (!(tolerance >= 0)) {
+        std::cout << "Invalid tolerance." << std::endl;
+        return;
+    }
 
-        double averageDistance = 0;
-        if (count > 0) { // Avoid division by zero
-            averageDistance = totalDistance / count;
+    // Search all files concurrently, print them in file order
+    std::vector<std::shared_ptr<const PointCloud>> clouds(suitablePointFiles.size());
+    std::vector<DuplicateSearch::Result> results(suitablePointFiles.size());
+    std::vector<std::vector<size_t>> kept(suitablePointFiles.size());
+    std::vector<char> searched(suitablePointFiles.size(), 0), overBudget(suitablePointFiles.size(), 0);
+    ThreadPool::shared().parallelFor(suitablePointFiles.size(), [&](size_t i) {
+        clouds[i] = pointCache.get(suitablePointFiles[i]);
+        if (clouds[i]) {
+            try {
+                Profiler::Scope scope(suitablePointFiles[i], "duplicates");
+                searched[i] = DuplicateSearch::find(*clouds[i], tolerance, results[i]);
+                if (searched[i] && !resultsDirectory.empty()) {
+                    kept[i] = DuplicateSearch::keptPoints(*clouds[i], results[i]);
+                }
+            } catch (const BudgetExceeded&) {
+                overBudget[i] = 1;
+            }
         }
+    });
 
-        // Print out the average distance for this file
+    for (size_t i = 0; i < suitablePointFiles.size(); ++i) {
+        const std::string& filename = suitablePointFiles[i];
+        if (!clouds[i]) {
+            _reportUnloaded(filename);
+            continue;
+        }
+        if (overBudget[i]) {
+            _reportOverBudget(filename);
+            continue;
+        }
+        if (!searched[i]) {
+            std::cerr << "Error: File " << filename << " has too many points to deduplicate." << std::endl;
+            continue;
+        }
+        Profiler::Scope scope(filename, "print");
         std::cout << "File: " << filename << std::endl;
-        std::cout << "Average distance between points: " << std::fixed << std::setprecision(3) << averageDistance << std::endl;
+        _printDuplicates(*clouds[i], results[i]);
+        if (!resultsDirectory.empty()) {
+            ResultWriter writer(std::cout);
+            _writeResultFile(writer, filename, "dedup", "deduplicated points", [&](PointFileWriter& file) {
+                _writeDeduplicatedPoints(file, *clouds[i], kept[i]);
+            });
+            writer.flush();
+            continue;
+        }
         std::cout << std::endl;
+    }
+}
 
-        // Reset the precision if needed elsewhere with default behavior
-        std::cout.unsetf(std::ios_base::fixed);
-        std::cout.precision(6);
+void downsamplePoints(const std::vector<std::string>& suitablePointFiles) {
+    double voxelSize;
+    std::cout << "Enter the voxel size: ";
+    std::cin >> voxelSize;
+    if (!(voxelSize > 0)) {
+        std::cout << "Invalid voxel size." << std::endl;
+        return;
+    }
+
+    // Downsample all files concurrently, print and write them in file order
+    std::vector<std::shared_ptr<const PointCloud>> clouds(suitablePointFiles.size());
+    std::vector<VoxelGrid::Result> results(suitablePointFiles.size());
+    std::vector<double> seconds(suitablePointFiles.size(), 0);
+    std::vector<char> downsampled(suitablePointFiles.size(), 0), overBudget(suitablePointFiles.size(), 0);
+    ThreadPool::shared().parallelFor(suitablePointFiles.size(), [&](size_t i) {
+        clouds[i] = pointCache.get(suitablePointFiles[i]);
+        if (clouds[i]) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                Profiler::Scope scope(suitablePointFiles[i], "downsample");
+                downsampled[i] = VoxelGrid::downsample(*clouds[i], voxelSize, results[i]);
+            } catch (const BudgetExceeded&) {
+                overBudget[i] = 1;
+            }
+            seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    });
+
+    for (size_t i = 0; i < suitablePointFiles.size(); ++i) {
+        const std::string& filename = suitablePointFiles[i];
+        if (!clouds[i]) {
+            _reportUnloaded(filename);
+            continue;
+        }
+        if (overBudget[i]) {
+            std::cerr << "Error: The downsampled points of " << filename << " do not fit in the memory budget." << std::endl;
+            continue;
+        }
+        if (!downsampled[i]) {
+            std::cerr << "Error: File " << filename << " has too many points to downsample." << std::endl;
+            continue;
+        }
+        Profiler::Scope scope(filename, "print");
+        std::cout << "File: " << filename << std::endl;
+        _printDownsampled(results[i], seconds[i]);
+
+        // Without a results directory the copy goes next to the file, where option 1 finds it
+        size_t slash = filename.find_last_of('/');
+        std::string directory = !resultsDirectory.empty() ? resultsDirectory : slash == std::string::npos ? "." : filename.substr(0, slash);
+        ResultWriter writer(std::cout);
+        _writeResultFile(writer, filename, "voxel", "voxel centroids", [&](PointFileWriter& file) {
+            _writeCentroids(file, results[i]);
+        }, directory);
+        writer.flush();
+        results[i] = VoxelGrid::Result();
     }
-}
\ No newline at end of file
+}